@@ -0,0 +1,112 @@
+# coding: utf-8
+"""Compare the C attribute codec of genl with hand-rolled struct.pack encoding.
+
+No kernel module is needed: the codec works on an arbitrary family id.
+"""
+from __future__ import print_function
+
+import struct
+import timeit
+
+import genl
+
+FAMILY_ID = 0x7FFF
+NUMBER = 100000
+
+NLA_HDRLEN = 4
+NLA_F_NESTED = 1 << 15
+
+ITEM_POLICY = [
+    ("index", genl.NLA_U32),
+    ("flags", genl.NLA_U8),
+]
+
+POLICY = [
+    ("msg", genl.NLA_BINARY),
+    ("count", genl.NLA_U32),
+    ("stamp", genl.NLA_U64),
+    ("name", genl.NLA_NUL_STRING),
+    ("item", genl.NLA_NESTED, ITEM_POLICY),
+]
+
+VALUE = {
+    "msg": b"\x40\x40\x40\x00" * 8,
+    "count": 1000,
+    "stamp": 1 << 40,
+    "name": "doc_exmpl",
+    "item": {"index": 7, "flags": 1},
+}
+
+
+def _align(n):
+    return (n + 3) & ~3
+
+
+def _put(type, payload):
+    size = NLA_HDRLEN + len(payload)
+    return struct.pack("HH", size, type) + payload + b"\x00" * (_align(size) - size)
+
+
+def py_encode(value):
+    item = value["item"]
+    nested = _put(1, struct.pack("I", item["index"])) + _put(2, struct.pack("B", item["flags"]))
+    return b"".join((
+        _put(1, value["msg"]),
+        _put(2, struct.pack("I", value["count"])),
+        _put(3, struct.pack("Q", value["stamp"])),
+        _put(4, value["name"].encode() + b"\x00"),
+        struct.pack("HH", NLA_HDRLEN + len(nested), 5 | NLA_F_NESTED) + nested,
+    ))
+
+
+def _attrs(data):
+    offset = 0
+    while offset + NLA_HDRLEN <= len(data):
+        size, type = struct.unpack_from("HH", data, offset)
+        yield type & ~NLA_F_NESTED, data[offset + NLA_HDRLEN:offset + size]
+        offset += _align(size)
+
+
+def py_decode(data):
+    result = {}
+    for type, payload in _attrs(data):
+        if type == 1:
+            result["msg"] = payload
+        elif type == 2:
+            result["count"] = struct.unpack("I", payload)[0]
+        elif type == 3:
+            result["stamp"] = struct.unpack("Q", payload)[0]
+        elif type == 4:
+            result["name"] = payload.rstrip(b"\x00").decode()
+        elif type == 5:
+            item = {}
+            for sub, value in _attrs(payload):
+                if sub == 1:
+                    item["index"] = struct.unpack("I", value)[0]
+                elif sub == 2:
+                    item["flags"] = struct.unpack("B", value)[0]
+            result["item"] = item
+    return result
+
+
+def bench(name, func):
+    seconds = min(timeit.repeat(func, number=NUMBER, repeat=3))
+    print("%-24s %8.3f us/op %10.0f op/s" % (name, seconds / NUMBER * 1e6, NUMBER / seconds))
+    return seconds
+
+
+if __name__ == "__main__":
+    genl.register_policy(FAMILY_ID, POLICY)
+
+    data = genl.encode(FAMILY_ID, VALUE)
+    assert data == py_encode(VALUE)
+    assert genl.decode(FAMILY_ID, data) == py_decode(data) == VALUE
+
+    c = bench("genl.encode", lambda: genl.encode(FAMILY_ID, VALUE))
+    p = bench("struct.pack encode", lambda: py_encode(VALUE))
+    print("encode speedup: %.1fx" % (p / c))
+
+    c = bench("genl.decode", lambda: genl.decode(FAMILY_ID, data))
+    bench("genl.decode(as_tuple)", lambda: genl.decode(FAMILY_ID, data, as_tuple=True))
+    p = bench("struct.unpack decode", lambda: py_decode(data))
+    print("decode speedup: %.1fx" % (p / c))
@@ -0,0 +1,263 @@
+# coding: utf-8
+"""Round-trip benchmark of the DOC_EXMPL echo path.
+
+    genl.send -> doc_exmpl_echo -> genl_send_msg_to_user -> genl.recv
+
+Every thread owns a socket and runs one of the modes:
+
+    raw        one request, then wait for its reply (genl.send/genl.recv);
+    pipelined  keep `--window` requests in flight (genl.request/genl.response);
+    batched    send `--batch` items per request (genl.send_batch/genl.recv_batch).
+
+Every request first encodes a record into the payload with the attribute codec.
+The time spent encoding is reported apart from the time spent in the calls
+which enter the kernel. The latency histogram has log2 buckets in microseconds.
+
+The combinations whose request does not fit in a message of genl.c are
+skipped. A request which cannot be sent is counted as a failure, and stops
+the thread.
+
+Usage: python bench_genl.py [--modes raw,pipelined,batched] [--threads 1,4]
+                            [--sizes 16,256,4096] [--duration 3] [--json]
+"""
+from __future__ import division, print_function
+
+import argparse
+import json
+import threading
+import time
+
+import genl
+
+clock = getattr(time, "perf_counter", time.time)
+
+# The record which is encoded into every payload. It has no relationship with
+# the family's attributes, so it is registered under an unused family id.
+RECORD_FAMILY = 0x7FFE
+RECORD_POLICY = [
+    ("seq", genl.NLA_U32),
+    ("stamp", genl.NLA_U64),
+    ("body", genl.NLA_BINARY),
+]
+
+# The room for the attributes of a message in genl.c (MAX_MSG_SIZE).
+MAX_ATTRS = 32768
+NLA_HDRLEN = 4
+
+
+def nla_align(n):
+    return (n + 3) & ~3
+
+
+def request_size(mode, size, batch):
+    """The size of the attributes of a request of the mode."""
+    item = NLA_HDRLEN + nla_align(len(genl.encode(RECORD_FAMILY, (0, 0, b"@" * size))))
+    if mode == "batched":
+        # The items are nested in DOC_EXMPL_A_BATCH.
+        return NLA_HDRLEN + batch * item
+    return item
+
+
+class Stats(object):
+    def __init__(self):
+        self.ops = 0
+        self.failures = 0
+        self.encode = 0.0
+        self.syscall = 0.0
+        self.latencies = []
+
+    def merge(self, other):
+        self.ops += other.ops
+        self.failures += other.failures
+        self.encode += other.encode
+        self.syscall += other.syscall
+        self.latencies.extend(other.latencies)
+
+
+def encode(stats, body, seq):
+    start = clock()
+    data = genl.encode(RECORD_FAMILY, (seq, 0, body))
+    stats.encode += clock() - start
+    return data
+
+
+def raw(sock, fid, body, args, deadline, stats):
+    seq = 0
+    while clock() < deadline:
+        start = clock()
+        data = encode(stats, body, seq)
+        call = clock()
+        if not genl.send(sock, fid, data, len(data)):
+            stats.failures += 1
+            return
+        genl.recv(sock, fid)
+        end = clock()
+        stats.syscall += end - call
+        stats.latencies.append(end - start)
+        stats.ops += 1
+        seq += 1
+
+
+def pipelined(sock, fid, body, args, deadline, stats):
+    sent = {}
+
+    def submit(n):
+        start = clock()
+        data = encode(stats, body, n)
+        call = clock()
+        seq = genl.request(sock, fid, data)
+        stats.syscall += clock() - call
+        if seq is None:
+            stats.failures += 1
+            return None
+        sent[seq] = start
+        return seq
+
+    n = 0
+    for n in range(args.window):
+        if submit(n) is None:
+            break
+    order = sorted(sent)
+    while order:
+        seq = order.pop(0)
+        call = clock()
+        genl.response(sock, fid, seq)
+        end = clock()
+        stats.syscall += end - call
+        stats.latencies.append(end - sent.pop(seq))
+        stats.ops += 1
+        if end < deadline:
+            n += 1
+            seq = submit(n)
+            if seq is not None:
+                order.append(seq)
+
+
+def batched(sock, fid, body, args, deadline, stats):
+    seq = 0
+    while clock() < deadline:
+        start = clock()
+        items = [encode(stats, body, seq + i) for i in range(args.batch)]
+        call = clock()
+        req = genl.send_batch(sock, fid, items)
+        if req is None:
+            stats.failures += 1
+            return
+        genl.recv_batch(sock, fid, req)
+        end = clock()
+        stats.syscall += end - call
+        # Every item of the batch waits for the whole batch.
+        stats.latencies.extend([end - start] * args.batch)
+        stats.ops += args.batch
+        seq += args.batch
+
+
+MODES = {"raw": raw, "pipelined": pipelined, "batched": batched}
+
+
+def worker(mode, body, args, deadline, stats):
+    sock, fid = genl.create()
+    try:
+        MODES[mode](sock, fid, body, args, deadline, stats)
+    finally:
+        genl.close(sock)
+
+
+def histogram(latencies):
+    buckets = {}
+    for lat in latencies:
+        us = max(1, int(lat * 1e6))
+        bucket = 1 << (us.bit_length() - 1)
+        buckets[bucket] = buckets.get(bucket, 0) + 1
+    return sorted(buckets.items())
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p))] * 1e6 if values else None
+
+
+def run(mode, size, threads, args):
+    body = b"@" * size
+    stats = [Stats() for _ in range(threads)]
+    deadline = clock() + args.duration
+    workers = [threading.Thread(target=worker, args=(mode, body, args, deadline, s)) for s in stats]
+    start = clock()
+    for t in workers:
+        t.start()
+    for t in workers:
+        t.join()
+    elapsed = clock() - start
+
+    total = Stats()
+    for s in stats:
+        total.merge(s)
+    total.latencies.sort()
+    ops = max(total.ops, 1)
+    return {
+        "mode": mode,
+        "size": size,
+        "threads": threads,
+        "ops_per_sec": total.ops / elapsed,
+        "failures": total.failures,
+        "encode_us_per_op": total.encode / ops * 1e6,
+        "syscall_us_per_op": total.syscall / ops * 1e6,
+        "latency_us": {
+            "p50": percentile(total.latencies, 0.50),
+            "p99": percentile(total.latencies, 0.99),
+            "p999": percentile(total.latencies, 0.999),
+        },
+        "histogram_us": histogram(total.latencies),
+    }
+
+
+def report(result):
+    print("%-9s size=%-5d threads=%-3d %10.0f ops/s  failures %d  encode %6.2f us  syscall %7.2f us  "
+          "p50 %7.1f  p99 %7.1f  p999 %7.1f us" % (
+              result["mode"], result["size"], result["threads"], result["ops_per_sec"],
+              result["failures"],
+              result["encode_us_per_op"], result["syscall_us_per_op"],
+              result["latency_us"]["p50"] or 0, result["latency_us"]["p99"] or 0,
+              result["latency_us"]["p999"] or 0))
+    for bucket, count in result["histogram_us"]:
+        print("    [%6d us, %6d us) %d" % (bucket, bucket * 2, count))
+
+
+def ints(text):
+    return [int(n) for n in text.split(",")]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--modes", default="raw,pipelined,batched")
+    parser.add_argument("--threads", type=ints, default=[1, 4])
+    parser.add_argument("--sizes", type=ints, default=[16, 256, 4096])
+    parser.add_argument("--duration", type=float, default=3)
+    parser.add_argument("--window", type=int, default=16)
+    parser.add_argument("--batch", type=int, default=64)
+    parser.add_argument("--json", action="store_true", help="print the results as JSON")
+    args = parser.parse_args()
+
+    sock, fid = genl.create()
+    genl.close(sock)
+    if not fid:
+        raise SystemExit("The DOC_EXMPL family is not registered; load test_genl.ko")
+    genl.register_policy(RECORD_FAMILY, RECORD_POLICY)
+
+    results = []
+    for mode in args.modes.split(","):
+        for size in args.sizes:
+            if request_size(mode, size, args.batch) > MAX_ATTRS:
+                if not args.json:
+                    print("%-9s size=%-5d skipped: the request exceeds %d bytes" % (mode, size, MAX_ATTRS))
+                continue
+            for threads in args.threads:
+                result = run(mode, size, threads, args)
+                results.append(result)
+                if not args.json:
+                    report(result)
+    if args.json:
+        print(json.dumps(results, indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,70 @@
+# coding: utf-8
+"""Multi-threaded load test of the DOC_EXMPL echo command.
+
+Every thread owns a socket and keeps `--window` requests in flight. With
+parallel_ops the request rate should scale with the number of threads, up to
+the number of cores.
+
+Usage: python bench_parallel.py [--threads 1,2,4,8] [--duration 5] [--size 64]
+"""
+from __future__ import print_function
+
+import argparse
+import multiprocessing
+import threading
+import time
+
+import genl
+
+
+def worker(data, window, deadline, counts, index):
+    sock, fid = genl.create()
+    if not fid:
+        raise SystemExit("The DOC_EXMPL family is not registered; load test_genl.ko")
+
+    done = 0
+    inflight = [genl.request(sock, fid, data) for _ in range(window)]
+    while time.time() < deadline:
+        genl.response(sock, fid, inflight.pop(0))
+        inflight.append(genl.request(sock, fid, data))
+        done += 1
+    for seq in inflight:
+        genl.response(sock, fid, seq)
+
+    genl.close(sock)
+    counts[index] = done
+
+
+def run(threads, data, window, duration):
+    counts = [0] * threads
+    deadline = time.time() + duration
+    workers = [threading.Thread(target=worker, args=(data, window, deadline, counts, i))
+               for i in range(threads)]
+    start = time.time()
+    for t in workers:
+        t.start()
+    for t in workers:
+        t.join()
+    return sum(counts) / (time.time() - start)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--threads", default="1,2,4,%d" % multiprocessing.cpu_count())
+    parser.add_argument("--duration", type=float, default=5)
+    parser.add_argument("--size", type=int, default=64)
+    parser.add_argument("--window", type=int, default=8)
+    args = parser.parse_args()
+
+    data = b"@" * args.size
+
+    base = None
+    print("%8s %12s %8s" % ("threads", "req/s", "scaling"))
+    for threads in sorted(set(int(n) for n in args.threads.split(","))):
+        rate = run(threads, data, args.window, args.duration)
+        base = base or rate
+        print("%8d %12.0f %7.2fx" % (threads, rate, rate / base))
+
+
+if __name__ == "__main__":
+    main()
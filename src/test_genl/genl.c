@@ -1,21 +1,38 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <linux/netlink.h>
 #include <linux/genetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/netlink_diag.h>
 
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <structmember.h>
 
 #define MAX_MSG_SIZE	32768
+#define MAX_DUMP_SIZE	32768	// The kernel never builds a dump skb larger than 32K.
+#define MAX_FAMILY_POLICY	16
+#define MAX_FD			1024
+#define MAX_NESTED_DEPTH	8
 
 #define GENLMSG_DATA(glh)       ((void *)(NLMSG_DATA(glh) + GENL_HDRLEN))
 #define NLA_DATA(na)            ((void *)((char *)(na) + NLA_HDRLEN))
+#define NLA_OK(na, len)         ((len) >= (int)NLA_HDRLEN && (na)->nla_len >= NLA_HDRLEN && \
+                                 (na)->nla_len <= (len))
+#define NLA_NEXT(na, len)       ((len) -= NLA_ALIGN((na)->nla_len), \
+                                 (struct nlattr *)((char *)(na) + NLA_ALIGN((na)->nla_len)))
 
 enum {
 	DOC_EXMPL_A_UNSPEC,
 	DOC_EXMPL_A_MSG,
+	DOC_EXMPL_A_INDEX,
+	DOC_EXMPL_A_VALUE,
+	DOC_EXMPL_A_BATCH,
 	__DOC_EXMPL_A_MAX,
 };
 #define DOC_EXMPL_A_MAX (__DOC_EXMPL_A_MAX - 1)
@@ -23,6 +40,9 @@ enum {
 enum {
 	DOC_EXMPL_C_UNSPEC,
 	DOC_EXMPL_C_ECHO,
+	DOC_EXMPL_C_DUMP,
+	DOC_EXMPL_C_NOTIFY,
+	DOC_EXMPL_C_BATCH,
 	__DOC_EXMPL_C_MAX,
 };
 #define DOC_EXMPL_C_MAX (__DOC_EXMPL_C_MAX - 1)
@@ -34,6 +54,199 @@ typedef struct msgtemplate {
 } msgtemplate_t;
 
 
+/*
+ * Per-socket statistics
+ *
+ * 收发路径上的计数器，按fd索引，由 stats() 读取。计数不加锁（收发时并不持有GIL），
+ * 多个线程共用一个socket时只是近似值。
+ */
+typedef struct genl_stats {
+	unsigned long long tx_msgs;
+	unsigned long long tx_bytes;
+	unsigned long long tx_syscalls;
+	unsigned long long rx_msgs;
+	unsigned long long rx_bytes;
+	unsigned long long rx_syscalls;
+	unsigned long long eagain;
+	unsigned long long enobufs;
+	unsigned long long errors;
+	unsigned long long discards;	// The messages of another family or request.
+} genl_stats_t;
+
+static genl_stats_t genl_stats[MAX_FD];
+static genl_stats_t genl_stats_none;	// Absorb the counts of an out-of-range fd.
+
+#define GENL_STATS(sd)	((sd) >= 0 && (sd) < MAX_FD ? &genl_stats[sd] : &genl_stats_none)
+
+
+static void genl_stats_error(genl_stats_t *st, int err)
+{
+	if (err == EAGAIN || err == EWOULDBLOCK) {
+		st->eagain++;
+	} else if (err == ENOBUFS) {
+		st->enobufs++;
+	} else if (err != EINTR) {
+		st->errors++;
+	}
+}
+
+
+/**
+ * * genl_recv_counted - recv()，同时更新socket的计数器
+ * *
+ * * return: 同 recv()
+ * */
+static int genl_recv_counted(int sd, void *buf, size_t len, int flags)
+{
+	genl_stats_t *st = GENL_STATS(sd);
+	int ret;
+
+	ret = recv(sd, buf, len, flags);
+	st->rx_syscalls++;
+	if (ret < 0) {
+		genl_stats_error(st, errno);
+	}
+	return ret;
+}
+
+
+/**
+ * * genl_diag_meminfo - 通过 NETLINK_SOCK_DIAG 查询socket的内存使用和丢包数
+ * *
+ * * @sd: 客户端socket
+ * * @protocol: socket的netlink协议
+ * * @meminfo: 返回 SK_MEMINFO_* 的值，旧内核不提供的项为0
+ * *
+ * * return:
+ * *    0:       成功
+ * *    -1:      失败
+ * */
+static int genl_diag_meminfo(int sd, int protocol, __u32 *meminfo)
+{
+	struct {
+		struct nlmsghdr n;
+		struct netlink_diag_req r;
+	} req;
+	char buf[MAX_DUMP_SIZE];
+	struct netlink_diag_msg *dm;
+	struct nlmsghdr *nlh;
+	struct nlattr *na;
+	struct stat st;
+	size_t size;
+	int fd, len, alen, ret = -1;
+
+	if (fstat(sd, &st) < 0) {
+		return -1;
+	}
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
+	if (fd < 0) {
+		return -1;
+	}
+
+	// The kernel dumps every socket of the protocol, so find ours by inode.
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = sizeof(req);
+	req.n.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.r.sdiag_family = AF_NETLINK;
+	req.r.sdiag_protocol = protocol;
+	req.r.ndiag_show = NDIAG_SHOW_MEMINFO;
+	if (send(fd, &req, sizeof(req), 0) < 0) {
+		goto out;
+	}
+
+	memset(meminfo, 0, SK_MEMINFO_VARS * sizeof(__u32));
+	for (;;) {
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			goto out;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) {
+				goto out;
+			}
+			dm = NLMSG_DATA(nlh);
+			if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*dm)) || dm->ndiag_ino != st.st_ino) {
+				continue;
+			}
+			alen = nlh->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(sizeof(*dm)));
+			na = (struct nlattr *)((char *)dm + NLMSG_ALIGN(sizeof(*dm)));
+			for (; NLA_OK(na, alen); na = NLA_NEXT(na, alen)) {
+				if ((na->nla_type & NLA_TYPE_MASK) == NETLINK_DIAG_MEMINFO) {
+					size = na->nla_len - NLA_HDRLEN;
+					if (size > SK_MEMINFO_VARS * sizeof(__u32))
+						size = SK_MEMINFO_VARS * sizeof(__u32);
+					memcpy(meminfo, NLA_DATA(na), size);
+					ret = 0;
+				}
+			}
+		}
+	}
+
+out:
+	close(fd);
+	return ret;
+}
+
+
+/**
+ * * genl_send_nlmsg - 发送一个已经构造好的generic netlink消息
+ * *
+ * * @sd: 客户端socket
+ * * @msg: 消息，长度由 msg->n.nlmsg_len 给出
+ * *
+ * * return:
+ * *    0:       成功
+ * *    -1:      失败
+ * */
+static int genl_send_nlmsg(int sd, msgtemplate_t *msg)
+{
+	genl_stats_t *st = GENL_STATS(sd);
+	struct sockaddr_nl nladdr;
+	int r, buflen;
+	char *buf;
+
+	buf = (char *) msg;
+	buflen = msg->n.nlmsg_len;
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	for (;;) {
+		r = sendto(sd, buf, buflen, 0, (struct sockaddr *) &nladdr, sizeof(nladdr));
+		st->tx_syscalls++;
+		if (r >= buflen) {
+			break;
+		}
+		if (r > 0) {
+			buf += r;
+			buflen -= r;
+		} else {
+			genl_stats_error(st, errno);
+			if (errno != EAGAIN) {
+				return -1;
+			}
+		}
+	}
+	st->tx_msgs++;
+	st->tx_bytes += msg->n.nlmsg_len;
+	return 0;
+}
+
+
+static void genl_put_header(msgtemplate_t *msg, u_int16_t nlmsg_type, u_int16_t flags,
+		u_int32_t seq, u_int8_t genl_cmd)
+{
+	msg->n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	msg->n.nlmsg_type = nlmsg_type;
+	msg->n.nlmsg_flags = NLM_F_REQUEST | flags;
+	msg->n.nlmsg_seq = seq;
+	msg->n.nlmsg_pid = getpid();
+	msg->g.cmd = genl_cmd;
+	msg->g.version = 1;
+	msg->g.reserved = 0;
+}
+
+
 /**
  * * genl_send_msg - 通过generic netlink给内核发送数据
  * *
@@ -54,219 +267,1722 @@ int genl_send_msg(int sd, u_int16_t nlmsg_type, u_int32_t nlmsg_pid,
         u_int8_t genl_cmd, u_int8_t genl_version, u_int16_t nla_type,
         void *nla_data, int nla_len)
 {
-	struct nlattr *na;
-	struct sockaddr_nl nladdr;
-	int r, buflen;
-	char *buf;
-	msgtemplate_t msg;
+	struct nlattr *na;
+	msgtemplate_t msg;
+
+
+	if (nlmsg_type == 0) {
+		return 0;
+	}
+
+	msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	msg.n.nlmsg_type = nlmsg_type;
+	msg.n.nlmsg_flags = NLM_F_REQUEST;
+	msg.n.nlmsg_seq = 0;
+	/*
+	 * nlmsg_pid是发送进程的端口号。
+	 * Linux内核不关心这个字段，仅用于跟踪消息。
+	 */
+	msg.n.nlmsg_pid = nlmsg_pid;
+	msg.g.cmd = genl_cmd;
+	msg.g.version = genl_version;
+	na = (struct nlattr *) GENLMSG_DATA(&msg);
+	na->nla_type = nla_type;
+	na->nla_len = nla_len + NLA_HDRLEN;
+	memcpy(NLA_DATA(na), nla_data, nla_len);
+	msg.n.nlmsg_len += NLMSG_ALIGN(na->nla_len);
+
+	return genl_send_nlmsg(sd, &msg);
+}
+
+
+/**
+ * * genl_get_family - 通过 Controller 查询family的ID，以及它的一个多播组的ID
+ * *
+ * * @sd: 客户端socket
+ * * @family_name: family的名字
+ * * @group_name: 多播组的名字，为NULL时不查询
+ * * @group_id: 返回多播组的ID，找不到时为0
+ * *
+ * * return:
+ * *    >0:      family_id
+ * *    0:       失败
+ * */
+static int genl_get_family(int sd, const char *family_name, const char *group_name, int *group_id)
+{
+	msgtemplate_t ans;
+	struct nlattr *na, *grp, *ga;
+	int rep_len, len, glen, galen;
+	int id = 0, gid;
+	const char *name;
+
+	if (genl_send_msg(sd, GENL_ID_CTRL, 0, CTRL_CMD_GETFAMILY, 1,
+			CTRL_ATTR_FAMILY_NAME, (void *)family_name,
+			strlen(family_name)+1) < 0) {
+		return 0;
+	}
+
+	// Skip the events of the groups which the socket has joined.
+	do {
+		rep_len = genl_recv_counted(sd, &ans, sizeof(ans), 0);
+		if (rep_len < 0) {
+			return 0;
+		}
+		if (ans.n.nlmsg_type == NLMSG_ERROR || !NLMSG_OK((&ans.n), rep_len)) {
+			return 0;
+		}
+	} while (ans.n.nlmsg_type != GENL_ID_CTRL);
+
+	len = ans.n.nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	for (na = (struct nlattr *) GENLMSG_DATA(&ans); NLA_OK(na, len); na = NLA_NEXT(na, len)) {
+		switch (na->nla_type & NLA_TYPE_MASK) {
+		case CTRL_ATTR_FAMILY_ID:
+			id = *(__u16 *) NLA_DATA(na);
+			break;
+		case CTRL_ATTR_MCAST_GROUPS:
+			if (!group_name) {
+				break;
+			}
+			glen = na->nla_len - NLA_HDRLEN;
+			for (grp = NLA_DATA(na); NLA_OK(grp, glen); grp = NLA_NEXT(grp, glen)) {
+				galen = grp->nla_len - NLA_HDRLEN;
+				name = NULL;
+				gid = 0;
+				for (ga = NLA_DATA(grp); NLA_OK(ga, galen); ga = NLA_NEXT(ga, galen)) {
+					if ((ga->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GRP_NAME) {
+						name = NLA_DATA(ga);
+					} else if ((ga->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GRP_ID) {
+						gid = *(__u32 *) NLA_DATA(ga);
+					}
+				}
+				if (name && !strcmp(name, group_name)) {
+					*group_id = gid;
+				}
+			}
+			break;
+		}
+	}
+
+	return id;
+}
+
+
+static int genl_get_family_id(int sd, char *family_name)
+{
+	return genl_get_family(sd, family_name, NULL, NULL);
+}
+
+
+/**
+ * * genl_recv_nlmsg - 接收一个发给family的generic netlink消息
+ * *
+ * * @fid: family_id
+ * * @sock: 客户端socket
+ * * @msg: 接收缓冲区
+ * *
+ * * return:
+ * *    >0:      genl头之后的属性流长度
+ * *    -1:      失败
+ * */
+static int genl_recv_nlmsg(int fid, int sock, msgtemplate_t *msg)
+{
+	genl_stats_t *st = GENL_STATS(sock);
+	int ret;
+
+	ret = genl_recv_counted(sock, msg, sizeof(*msg), 0);
+	if (ret < 0) {
+		return -1;
+	}
+
+	if (msg->n.nlmsg_type == NLMSG_ERROR || !NLMSG_OK((&msg->n), ret)) {
+		return -1;
+	}
+
+	if (msg->n.nlmsg_type != fid || fid == 0) {
+		st->discards++;
+		return -1;
+	}
+
+	st->rx_msgs++;
+	st->rx_bytes += msg->n.nlmsg_len;
+	return msg->n.nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+}
+
+
+int genl_rcv_msg(int fid, int sock, msgtemplate_t *msg, void **data, size_t *len)
+{
+	struct nlattr *na;
+	int ret;
+
+	ret = genl_recv_nlmsg(fid, sock, msg);
+	if (ret < 0) {
+		return -1;
+	}
+
+	// 第一个属性必须完整地落在收到的载荷内
+	na = (struct nlattr *) GENLMSG_DATA(msg);
+	if (!NLA_OK(na, ret)) {
+		return -1;
+	}
+	*data = (char *)NLA_DATA(na);
+	*len = (size_t)na->nla_len - NLA_HDRLEN;
+	return 0;
+}
+
+
+/*
+ * Attribute codec
+ *
+ * 用户空间的属性策略与内核中的 doc_exmpl_genl_policy 对应：第 N 个策略项描述属性
+ * 类型 N（0 保留给 UNSPEC）。策略在注册时被编译成 genl_policy_t，之后编码和解码
+ * 都在 C 中一次遍历 TLV 流完成。
+ */
+enum {
+	GENL_CODEC_UNSPEC,
+	GENL_CODEC_U8,
+	GENL_CODEC_U16,
+	GENL_CODEC_U32,
+	GENL_CODEC_U64,
+	GENL_CODEC_STRING,
+	GENL_CODEC_NUL_STRING,
+	GENL_CODEC_BINARY,
+	GENL_CODEC_NESTED,
+	__GENL_CODEC_MAX,
+};
+
+#if PY_MAJOR_VERSION >= 3
+#define GENL_STR_FROM(s, n)	PyUnicode_DecodeUTF8((s), (n), "surrogateescape")
+#define GENL_BYTES_FMT		"y#"
+#else
+#define GENL_STR_FROM(s, n)	PyString_FromStringAndSize((s), (n))
+#define GENL_BYTES_FMT		"s#"
+#endif
+
+typedef struct genl_policy genl_policy_t;
+
+typedef struct genl_attr_policy {
+	int kind;
+	PyObject *name;
+	genl_policy_t *nested;
+} genl_attr_policy_t;
+
+struct genl_policy {
+	int maxattr;
+	PyObject *tuple_type;		// namedtuple type used by decode(as_tuple=True)
+	genl_attr_policy_t attrs[1];	// attrs[1..maxattr]
+};
+
+static struct {
+	int family_id;
+	genl_policy_t *policy;
+} family_policy[MAX_FAMILY_POLICY];
+
+
+static void genl_policy_free(genl_policy_t *policy)
+{
+	int i;
+
+	if (!policy) {
+		return;
+	}
+
+	for (i = 1; i <= policy->maxattr; i++) {
+		Py_XDECREF(policy->attrs[i].name);
+		genl_policy_free(policy->attrs[i].nested);
+	}
+	Py_XDECREF(policy->tuple_type);
+	free(policy);
+}
+
+
+// spec: [(name, kind[, nested_spec]), ...]
+static genl_policy_t *genl_policy_compile(PyObject *spec, PyObject *typename, int depth)
+{
+	PyObject *seq = NULL, *names = NULL, *collections = NULL;
+	PyObject *item, *name, *sub;
+	genl_policy_t *policy = NULL;
+	genl_attr_policy_t *attr;
+	Py_ssize_t i, n;
+	int kind;
+
+	if (depth > MAX_NESTED_DEPTH) {
+		PyErr_SetString(PyExc_ValueError, "policy is nested too deeply");
+		return NULL;
+	}
+
+	seq = PySequence_Fast(spec, "policy must be a sequence of (name, type[, nested]) tuples");
+	if (!seq) {
+		return NULL;
+	}
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	if (n == 0 || n > (NLA_TYPE_MASK & 0xFFFF)) {
+		PyErr_SetString(PyExc_ValueError, "policy must describe between 1 and 16383 attributes");
+		goto error;
+	}
+
+	policy = calloc(1, sizeof(*policy) + n * sizeof(genl_attr_policy_t));
+	names = PyTuple_New(n);
+	if (!policy || !names) {
+		PyErr_NoMemory();
+		goto error;
+	}
+	policy->maxattr = (int)n;
+
+	for (i = 0; i < n; i++) {
+		item = PySequence_Fast_GET_ITEM(seq, i);
+		sub = NULL;
+		if (!PyTuple_Check(item) || !PyArg_ParseTuple(item, "Oi|O", &name, &kind, &sub)) {
+			PyErr_SetString(PyExc_TypeError, "policy entry must be a (name, type[, nested]) tuple");
+			goto error;
+		}
+		if (kind <= GENL_CODEC_UNSPEC || kind >= __GENL_CODEC_MAX) {
+			PyErr_Format(PyExc_ValueError, "unknown attribute type %d", kind);
+			goto error;
+		}
+
+		attr = &policy->attrs[i + 1];
+		attr->kind = kind;
+		Py_INCREF(name);
+		attr->name = name;
+		Py_INCREF(name);
+		PyTuple_SET_ITEM(names, i, name);
+
+		if (kind == GENL_CODEC_NESTED) {
+			if (!sub) {
+				PyErr_SetString(PyExc_ValueError, "nested attribute requires a policy");
+				goto error;
+			}
+			attr->nested = genl_policy_compile(sub, name, depth + 1);
+			if (!attr->nested) {
+				goto error;
+			}
+		}
+	}
+
+	collections = PyImport_ImportModule("collections");
+	if (!collections) {
+		goto error;
+	}
+	policy->tuple_type = PyObject_CallMethod(collections, "namedtuple", "OO", typename, names);
+	if (!policy->tuple_type) {
+		goto error;
+	}
+
+	Py_DECREF(collections);
+	Py_DECREF(names);
+	Py_DECREF(seq);
+	return policy;
+
+error:
+	Py_XDECREF(collections);
+	Py_XDECREF(names);
+	Py_XDECREF(seq);
+	genl_policy_free(policy);
+	return NULL;
+}
+
+
+static genl_policy_t *genl_policy_find(int family_id)
+{
+	int i;
+
+	for (i = 0; i < MAX_FAMILY_POLICY; i++) {
+		if (family_policy[i].policy && family_policy[i].family_id == family_id) {
+			return family_policy[i].policy;
+		}
+	}
+	return NULL;
+}
+
+
+static genl_policy_t *genl_policy_lookup(int family_id)
+{
+	genl_policy_t *policy = genl_policy_find(family_id);
+
+	if (!policy) {
+		PyErr_Format(PyExc_ValueError, "no policy registered for family %d", family_id);
+	}
+	return policy;
+}
+
+
+static int genl_put_attr(char *buf, size_t cap, size_t *off, int type, const void *data, size_t len)
+{
+	struct nlattr *na;
+	size_t total = NLA_HDRLEN + len;
+
+	if (total > 0xFFFF || *off + NLA_ALIGN(total) > cap) {
+		PyErr_SetString(PyExc_OverflowError, "attributes exceed the message size");
+		return -1;
+	}
+
+	na = (struct nlattr *)(buf + *off);
+	na->nla_type = type;
+	na->nla_len = total;
+	if (len)
+		memcpy(NLA_DATA(na), data, len);
+	memset((char *)na + total, 0, NLA_ALIGN(total) - total);
+	*off += NLA_ALIGN(total);
+	return 0;
+}
+
+
+static int genl_as_uint(PyObject *value, unsigned long long max, unsigned long long *out)
+{
+	unsigned long long v;
+
+	v = PyLong_AsUnsignedLongLong(value);
+	if (PyErr_Occurred()) {
+		return -1;
+	}
+	if (v > max) {
+		PyErr_SetString(PyExc_OverflowError, "integer attribute out of range");
+		return -1;
+	}
+
+	*out = v;
+	return 0;
+}
+
+
+static int genl_encode_obj(genl_policy_t *policy, PyObject *obj, char *buf, size_t cap, size_t *off);
+
+static int genl_encode_value(genl_attr_policy_t *attr, int type, PyObject *value,
+		char *buf, size_t cap, size_t *off)
+{
+	unsigned long long v;
+	const char *str;
+	Py_ssize_t len;
+	Py_buffer view;
+	struct nlattr *na;
+	size_t start;
+	int ret;
+
+	switch (attr->kind) {
+	case GENL_CODEC_U8: {
+		__u8 u8;
+		if (genl_as_uint(value, 0xFF, &v) < 0)
+			return -1;
+		u8 = (__u8)v;
+		return genl_put_attr(buf, cap, off, type, &u8, sizeof(u8));
+	}
+	case GENL_CODEC_U16: {
+		__u16 u16;
+		if (genl_as_uint(value, 0xFFFF, &v) < 0)
+			return -1;
+		u16 = (__u16)v;
+		return genl_put_attr(buf, cap, off, type, &u16, sizeof(u16));
+	}
+	case GENL_CODEC_U32: {
+		__u32 u32;
+		if (genl_as_uint(value, 0xFFFFFFFFULL, &v) < 0)
+			return -1;
+		u32 = (__u32)v;
+		return genl_put_attr(buf, cap, off, type, &u32, sizeof(u32));
+	}
+	case GENL_CODEC_U64: {
+		__u64 u64;
+		if (genl_as_uint(value, ~0ULL, &v) < 0)
+			return -1;
+		u64 = (__u64)v;
+		return genl_put_attr(buf, cap, off, type, &u64, sizeof(u64));
+	}
+	case GENL_CODEC_STRING:
+	case GENL_CODEC_NUL_STRING:
+#if PY_MAJOR_VERSION >= 3
+		if (PyUnicode_Check(value)) {
+			str = PyUnicode_AsUTF8AndSize(value, &len);
+			if (!str)
+				return -1;
+		} else
+#endif
+		if (PyBytes_Check(value)) {
+			str = PyBytes_AS_STRING(value);
+			len = PyBytes_GET_SIZE(value);
+		} else {
+			PyErr_SetString(PyExc_TypeError, "string attribute requires str or bytes");
+			return -1;
+		}
+		// Both representations keep a trailing NUL after the data.
+		if (attr->kind == GENL_CODEC_NUL_STRING)
+			len += 1;
+		return genl_put_attr(buf, cap, off, type, str, (size_t)len);
+	case GENL_CODEC_BINARY:
+		if (PyObject_GetBuffer(value, &view, PyBUF_SIMPLE) < 0)
+			return -1;
+		ret = genl_put_attr(buf, cap, off, type, view.buf, (size_t)view.len);
+		PyBuffer_Release(&view);
+		return ret;
+	case GENL_CODEC_NESTED:
+		start = *off;
+		if (genl_put_attr(buf, cap, off, type | NLA_F_NESTED, NULL, 0) < 0)
+			return -1;
+		if (genl_encode_obj(attr->nested, value, buf, cap, off) < 0)
+			return -1;
+		if (*off - start > 0xFFFF) {
+			PyErr_SetString(PyExc_OverflowError, "nested attribute is too large");
+			return -1;
+		}
+		na = (struct nlattr *)(buf + start);
+		na->nla_len = *off - start;
+		return 0;
+	}
+
+	PyErr_SetString(PyExc_ValueError, "unknown attribute type");
+	return -1;
+}
+
+
+// obj: a dict keyed by attribute name, or a tuple/list ordered by attribute type.
+// The None values are skipped.
+static int genl_encode_obj(genl_policy_t *policy, PyObject *obj, char *buf, size_t cap, size_t *off)
+{
+	PyObject *value;
+	Py_ssize_t i, n;
+
+	if (PyDict_Check(obj)) {
+		for (i = 1; i <= policy->maxattr; i++) {
+			value = PyDict_GetItem(obj, policy->attrs[i].name);
+			if (!value || value == Py_None)
+				continue;
+			if (genl_encode_value(&policy->attrs[i], (int)i, value, buf, cap, off) < 0)
+				return -1;
+		}
+		return 0;
+	}
+
+	if (PyTuple_Check(obj) || PyList_Check(obj)) {
+		n = PySequence_Fast_GET_SIZE(obj);
+		if (n > policy->maxattr) {
+			PyErr_SetString(PyExc_ValueError, "more values than attributes in the policy");
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			value = PySequence_Fast_GET_ITEM(obj, i);
+			if (value == Py_None)
+				continue;
+			if (genl_encode_value(&policy->attrs[i + 1], (int)i + 1, value, buf, cap, off) < 0)
+				return -1;
+		}
+		return 0;
+	}
+
+	PyErr_SetString(PyExc_TypeError, "attributes must be a dict, tuple or list");
+	return -1;
+}
+
+
+static PyObject *genl_decode_stream(genl_policy_t *policy, const char *data, size_t len, int as_tuple);
+
+static PyObject *genl_decode_value(genl_attr_policy_t *attr, const char *data, size_t len, int as_tuple)
+{
+	switch (attr->kind) {
+	case GENL_CODEC_U8:
+		if (len < sizeof(__u8))
+			break;
+		return PyLong_FromUnsignedLong(*(__u8 *)data);
+	case GENL_CODEC_U16:
+		if (len < sizeof(__u16))
+			break;
+		return PyLong_FromUnsignedLong(*(__u16 *)data);
+	case GENL_CODEC_U32:
+		if (len < sizeof(__u32))
+			break;
+		return PyLong_FromUnsignedLong(*(__u32 *)data);
+	case GENL_CODEC_U64: {
+		__u64 u64;
+		if (len < sizeof(__u64))
+			break;
+		memcpy(&u64, data, sizeof(u64));	// Attributes are only 4-byte aligned.
+		return PyLong_FromUnsignedLongLong(u64);
+	}
+	case GENL_CODEC_STRING:
+		return GENL_STR_FROM(data, (Py_ssize_t)len);
+	case GENL_CODEC_NUL_STRING:
+		return GENL_STR_FROM(data, (Py_ssize_t)strnlen(data, len));
+	case GENL_CODEC_BINARY:
+		return PyBytes_FromStringAndSize(data, (Py_ssize_t)len);
+	case GENL_CODEC_NESTED:
+		return genl_decode_stream(attr->nested, data, len, as_tuple);
+	}
+
+	PyErr_SetString(PyExc_ValueError, "truncated attribute");
+	return NULL;
+}
+
+
+// Attributes which are not in the policy are ignored. If an attribute appears
+// more than once, the last one wins.
+static PyObject *genl_decode_stream(genl_policy_t *policy, const char *data, size_t len, int as_tuple)
+{
+	const struct nlattr *na;
+	PyObject *values, *value, *args, *result;
+	size_t alen;
+	int type, i;
+
+	if (as_tuple) {
+		values = PyTuple_New(policy->maxattr);
+		if (!values)
+			return NULL;
+		for (i = 0; i < policy->maxattr; i++) {
+			Py_INCREF(Py_None);
+			PyTuple_SET_ITEM(values, i, Py_None);
+		}
+	} else {
+		values = PyDict_New();
+		if (!values)
+			return NULL;
+	}
+
+	while (len >= NLA_HDRLEN) {
+		na = (const struct nlattr *)data;
+		alen = na->nla_len;
+		if (alen < NLA_HDRLEN || alen > len) {
+			PyErr_SetString(PyExc_ValueError, "malformed attribute stream");
+			goto error;
+		}
+
+		type = na->nla_type & NLA_TYPE_MASK;
+		if (type >= 1 && type <= policy->maxattr) {
+			value = genl_decode_value(&policy->attrs[type], (const char *)NLA_DATA(na),
+					alen - NLA_HDRLEN, as_tuple);
+			if (!value)
+				goto error;
+
+			if (as_tuple) {
+				Py_DECREF(PyTuple_GET_ITEM(values, type - 1));
+				PyTuple_SET_ITEM(values, type - 1, value);
+			} else {
+				if (PyDict_SetItem(values, policy->attrs[type].name, value) < 0) {
+					Py_DECREF(value);
+					goto error;
+				}
+				Py_DECREF(value);
+			}
+		}
+
+		if (NLA_ALIGN(alen) >= len)
+			break;
+		data += NLA_ALIGN(alen);
+		len -= NLA_ALIGN(alen);
+	}
+
+	if (!as_tuple)
+		return values;
+
+	// Bypass the namedtuple's python-level __new__.
+	args = PyTuple_Pack(1, values);
+	Py_DECREF(values);
+	if (!args)
+		return NULL;
+	result = PyTuple_Type.tp_new((PyTypeObject *)policy->tuple_type, args, NULL);
+	Py_DECREF(args);
+	return result;
+
+error:
+	Py_DECREF(values);
+	return NULL;
+}
+
+
+static int genl_send_attrs(int sd, int family_id, u_int8_t genl_cmd, genl_policy_t *policy, PyObject *obj)
+{
+	msgtemplate_t msg;
+	size_t len = 0;
+	int ret;
+
+	if (genl_encode_obj(policy, obj, msg.data, sizeof(msg.data), &len) < 0) {
+		return -2;
+	}
+
+	genl_put_header(&msg, family_id, 0, 0, genl_cmd);
+	msg.n.nlmsg_len += len;
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = genl_send_nlmsg(sd, &msg);
+	Py_END_ALLOW_THREADS
+	return ret;
+}
+
+
+/*
+ * Per-socket state
+ *
+ * 每个socket维护自己的序列号以及在途请求表：请求带上递增的 nlmsg_seq，内核在回复中
+ * 原样带回，用户空间据此（以及 nlmsg_pid）把乱序到达的回复匹配回对应的请求。
+ */
+typedef struct genl_sock {
+	u_int32_t seq;
+	u_int32_t portid;
+	PyObject *pending;	// seq => callback/None, the requests in flight
+	PyObject *ready;	// seq => response, the responses not yet collected
+} genl_sock_t;
+
+static genl_sock_t *genl_socks[MAX_FD];
+
+
+static genl_sock_t *genl_sock_get(int sock)
+{
+	genl_sock_t *gs;
+	struct sockaddr_nl local;
+	socklen_t addrlen = sizeof(local);
+
+	if (sock < 0 || sock >= MAX_FD) {
+		PyErr_SetString(PyExc_ValueError, "more than the max file description");
+		return NULL;
+	}
+	if (genl_socks[sock]) {
+		return genl_socks[sock];
+	}
+
+	memset(&local, 0, sizeof(local));
+	if (getsockname(sock, (struct sockaddr *)&local, &addrlen) < 0) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		return NULL;
+	}
+
+	gs = calloc(1, sizeof(*gs));
+	if (!gs) {
+		PyErr_NoMemory();
+		return NULL;
+	}
+	gs->portid = local.nl_pid;
+	gs->pending = PyDict_New();
+	gs->ready = PyDict_New();
+	if (!gs->pending || !gs->ready) {
+		Py_XDECREF(gs->pending);
+		Py_XDECREF(gs->ready);
+		free(gs);
+		return NULL;
+	}
+
+	genl_socks[sock] = gs;
+	return gs;
+}
+
+
+static void genl_sock_release(int sock)
+{
+	genl_sock_t *gs;
+
+	if (sock < 0 || sock >= MAX_FD || !genl_socks[sock]) {
+		return;
+	}
+
+	gs = genl_socks[sock];
+	genl_socks[sock] = NULL;
+	Py_DECREF(gs->pending);
+	Py_DECREF(gs->ready);
+	free(gs);
+}
+
+
+static u_int32_t genl_next_seq(genl_sock_t *gs)
+{
+	if (++gs->seq == 0)
+		++gs->seq;
+	return gs->seq;
+}
+
+
+// The response of a message: the decoded attributes if the family has a
+// registered policy, or else the payload of the first attribute. An error
+// message gives None.
+static PyObject *genl_response_value(int family_id, struct nlmsghdr *nlh)
+{
+	genl_policy_t *policy;
+	struct nlattr *na;
+	char *data;
+	int len;
+
+	if (nlh->nlmsg_type != family_id || nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) {
+		Py_RETURN_NONE;
+	}
+
+	data = (char *)NLMSG_DATA(nlh) + GENL_HDRLEN;
+	len = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	policy = genl_policy_find(family_id);
+	if (policy) {
+		return genl_decode_stream(policy, data, (size_t)len, 0);
+	}
+
+	na = (struct nlattr *)data;
+	if (len < NLA_HDRLEN || na->nla_len < NLA_HDRLEN || na->nla_len > len) {
+		Py_RETURN_NONE;
+	}
+	return PyBytes_FromStringAndSize((char *)NLA_DATA(na), na->nla_len - NLA_HDRLEN);
+}
+
+
+/**
+ * * genl_pipeline_recv - 接收一个数据报，把其中的每个回复交给对应的请求
+ * *
+ * * 请求若注册了回调，则调用 callback(seq, response)；否则把回复保存到 ready 中，
+ * * 等待 response() 取走。不属于在途请求的消息被丢弃。
+ * *
+ * * return:
+ * *    >=0:     处理的回复数
+ * *    -1:      recv 失败，见 errno
+ * *    -2:      回调抛出了异常
+ * */
+static int genl_pipeline_recv(int sock, int family_id, genl_sock_t *gs, int flags)
+{
+	genl_stats_t *st = GENL_STATS(sock);
+	msgtemplate_t msg;
+	struct nlmsghdr *nlh;
+	PyObject *key, *callback, *value, *ret;
+	PyObject *exc = NULL, *exc_value = NULL, *exc_tb = NULL;
+	int len, n = 0;
+
+	Py_BEGIN_ALLOW_THREADS
+	len = genl_recv_counted(sock, &msg, sizeof(msg), flags);
+	Py_END_ALLOW_THREADS
+	if (len < 0) {
+		return -1;
+	}
+
+	for (nlh = &msg.n; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		if (nlh->nlmsg_pid != gs->portid) {
+			st->discards++;
+			continue;
+		}
+
+		key = PyLong_FromUnsignedLong(nlh->nlmsg_seq);
+		if (!key) {
+			PyErr_Clear();
+			continue;
+		}
+		callback = PyDict_GetItem(gs->pending, key);
+		if (!callback) {
+			Py_DECREF(key);
+			st->discards++;
+			continue;
+		}
+		st->rx_msgs++;
+		st->rx_bytes += nlh->nlmsg_len;
+		Py_INCREF(callback);
+		PyDict_DelItem(gs->pending, key);
+
+		value = genl_response_value(family_id, nlh);
+		if (!value) {
+			// Cannot decode it, but the request is still answered.
+			PyErr_Clear();
+			Py_INCREF(Py_None);
+			value = Py_None;
+		}
+
+		if (callback != Py_None) {
+			ret = PyObject_CallFunctionObjArgs(callback, key, value, NULL);
+			if (ret) {
+				Py_DECREF(ret);
+			} else if (!exc) {
+				PyErr_Fetch(&exc, &exc_value, &exc_tb);
+			} else {
+				PyErr_Clear();
+			}
+		} else if (PyDict_SetItem(gs->ready, key, value) < 0) {
+			PyErr_Clear();
+		}
+
+		Py_DECREF(value);
+		Py_DECREF(callback);
+		Py_DECREF(key);
+		n++;
+	}
+
+	if (exc) {
+		PyErr_Restore(exc, exc_value, exc_tb);
+		return -2;
+	}
+	return n;
+}
+
+
+/*
+ * Dump iterator
+ *
+ * dump() 发送一个 NLM_F_DUMP 请求，之后每次 recv 读入内核的一整个 skb（其中包含许多
+ * NLM_F_MULTI 消息），再逐个交给 Python，直到 NLMSG_DONE。整个 dump 不会在内存中展开。
+ */
+typedef struct {
+	PyObject_HEAD
+	int sock;
+	int family_id;
+	int as_tuple;
+	int done;
+	u_int32_t seq;
+	unsigned long syscalls;
+	char *buf;
+	int len;
+	int offset;
+} genl_dump_t;
+
+static void genl_dump_dealloc(genl_dump_t *it)
+{
+	free(it->buf);
+	PyObject_Del(it);
+}
+
+
+static PyObject *genl_dump_next(genl_dump_t *it)
+{
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	genl_policy_t *policy;
+	char *data;
+	int len;
+	int ret;
+
+	while (!it->done) {
+		if (it->offset >= it->len) {
+			Py_BEGIN_ALLOW_THREADS
+			ret = genl_recv_counted(it->sock, it->buf, MAX_DUMP_SIZE, 0);
+			Py_END_ALLOW_THREADS
+			it->syscalls++;
+			if (ret < 0) {
+				if (errno == EINTR && !PyErr_CheckSignals())
+					continue;
+				it->done = 1;
+				return errno == EINTR ? NULL : PyErr_SetFromErrno(PyExc_OSError);
+			}
+			it->len = ret;
+			it->offset = 0;
+		}
+
+		nlh = (struct nlmsghdr *)(it->buf + it->offset);
+		if (!NLMSG_OK(nlh, it->len - it->offset)) {
+			it->offset = it->len;
+			continue;
+		}
+		it->offset += NLMSG_ALIGN(nlh->nlmsg_len);
+
+		if (nlh->nlmsg_seq != it->seq) {
+			GENL_STATS(it->sock)->discards++;
+			continue;
+		}
+
+		if (nlh->nlmsg_type == NLMSG_DONE) {
+			it->done = 1;
+			break;
+		}
+		if (nlh->nlmsg_type == NLMSG_ERROR) {
+			it->done = 1;
+			err = (struct nlmsgerr *)NLMSG_DATA(nlh);
+			errno = -err->error;
+			return PyErr_SetFromErrno(PyExc_OSError);
+		}
+		if (nlh->nlmsg_type != it->family_id || nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) {
+			GENL_STATS(it->sock)->discards++;
+			continue;
+		}
+		GENL_STATS(it->sock)->rx_msgs++;
+		GENL_STATS(it->sock)->rx_bytes += nlh->nlmsg_len;
+
+		data = (char *)NLMSG_DATA(nlh) + GENL_HDRLEN;
+		len = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+		policy = genl_policy_find(it->family_id);
+		if (policy)
+			return genl_decode_stream(policy, data, (size_t)len, it->as_tuple);
+		return PyBytes_FromStringAndSize(data, len);
+	}
+
+	return NULL;
+}
+
+
+static PyMemberDef genl_dump_members[] = {
+	{"syscalls", T_ULONG, offsetof(genl_dump_t, syscalls), READONLY, "The number of recv calls so far"},
+	{NULL, 0, 0, 0, NULL},
+};
+
+static PyTypeObject genl_dump_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "genl.DumpIterator",
+	.tp_basicsize = sizeof(genl_dump_t),
+	.tp_dealloc = (destructor)genl_dump_dealloc,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Iterate over the messages of a generic netlink dump",
+	.tp_iter = PyObject_SelfIter,
+	.tp_iternext = (iternextfunc)genl_dump_next,
+	.tp_members = genl_dump_members,
+};
+
+
+static int _py_genl_create(int *sock, int *family_id)
+{
+	int _sock = -1;
+	int _family_id;
+	struct sockaddr_nl local;
+
+	// Create Generic Netlink Socket.
+	errno = 0;
+	_sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (_sock < 0) {
+		printf("Failed to create genl socket: %s", strerror(errno));
+		goto error;
+	}
+
+	// Let the kernel assign a unique portid, so that a process (e.g. one
+	// thread per socket) can own more than one socket.
+	memset(&local, 0, sizeof(local));
+	local.nl_family = AF_NETLINK;
+	local.nl_pid = 0;
+
+	errno = 0;
+	if (bind(_sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+		printf("Failed to bind genl socket: %s", strerror(errno));
+		goto error;
+	}
+
+	if (_sock < MAX_FD) {
+		memset(&genl_stats[_sock], 0, sizeof(genl_stats[_sock]));
+	}
+
+	// Get family id
+	_family_id = genl_get_family_id(_sock, "DOC_EXMPL");
+
+	*sock = _sock;
+	*family_id = _family_id;
+	return 0;
+
+error:
+	if (_sock >= 0) {
+		close(_sock);
+	}
+	return -1;
+}
+
+
+static int _py_genl_recv(int sock, int family_id, msgtemplate_t *msg, void **data, size_t *size)
+{
+	return genl_rcv_msg(family_id, sock, msg, data, size);
+}
+
+static int _py_genl_send(int sock, int family_id, u_int8_t cmd, char *data, size_t size)
+{
+	return genl_send_msg(sock, family_id, getpid(), cmd, 1,
+			DOC_EXMPL_A_MSG, data, size);
+}
+
+////////////////////////////////////////////////////////
+
+// create() ==> (sock, family_id)/None
+static PyObject * py_genl_create(PyObject *self)
+{
+	int sock, family_id;
+
+	if (_py_genl_create(&sock, &family_id) == -1) {
+		Py_RETURN_NONE;
+	}
+
+	return Py_BuildValue("(ii)", sock, family_id);
+}
+
+
+// send(sock, family_id, data, size[, cmd=DOC_EXMPL_C_ECHO]) ==> True(success)/False(failure)
+static PyObject * py_genl_send(PyObject *self, PyObject *args)
+{
+	int sock;
+	int family_id;
+	char *data;
+	unsigned long size;
+	Py_ssize_t _size;
+	int cmd = DOC_EXMPL_C_ECHO;
+	int ret;
+	if (!PyArg_ParseTuple(args, "iiz#k|i", &sock, &family_id, &data, &_size, &size, &cmd)) {
+		return Py_BuildValue("i", -2);
+		//return NULL;   // Raise a Exception
+	}
+
+	if (size != _size) {
+		Py_RETURN_FALSE;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = _py_genl_send(sock, family_id, (u_int8_t)cmd, data, (size_t)size);
+	Py_END_ALLOW_THREADS
+	if (!ret)
+		Py_RETURN_TRUE;
+	else
+		Py_RETURN_FALSE;
+}
+
+
+// recv(sock, family_id)  ===> (byte_num, data)/None
+static PyObject * py_genl_recv(PyObject *self, PyObject *args)
+{
+	int sock;
+	int family_id;
+	char *data;
+	int err;
+	size_t size;
+	msgtemplate_t msg;
+
+	if (!PyArg_ParseTuple(args, "ii", &sock, &family_id)) {
+		Py_RETURN_NONE;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	err = _py_genl_recv(sock, family_id, &msg, (void*)&data, &size);
+	Py_END_ALLOW_THREADS
+	if (err < 0) {
+		Py_RETURN_NONE;
+	}
+
+	return Py_BuildValue("(I" GENL_BYTES_FMT ")", (unsigned int)size, data, (Py_ssize_t)size);
+}
+
+
+// register_policy(family_id, spec[, name="Attrs"]) ==> True(success)/False(table full)
+// spec: [(name, type[, nested_spec]), ...], the i-th entry describes the attribute type i+1.
+static PyObject * py_genl_register_policy(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int family_id;
+	int i, slot = -1;
+	PyObject *spec;
+	PyObject *typename = NULL;
+	genl_policy_t *policy;
+	static char *kwlist[] = {"family_id", "spec", "name", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "iO|O", kwlist, &family_id, &spec, &typename)) {
+		return NULL;
+	}
+
+	for (i = 0; i < MAX_FAMILY_POLICY; i++) {
+		if (family_policy[i].policy && family_policy[i].family_id == family_id) {
+			slot = i;
+			break;
+		}
+		if (!family_policy[i].policy && slot < 0) {
+			slot = i;
+		}
+	}
+	if (slot < 0) {
+		Py_RETURN_FALSE;
+	}
+
+	if (typename) {
+		Py_INCREF(typename);
+	} else {
+		typename = Py_BuildValue("s", "Attrs");
+		if (!typename)
+			return NULL;
+	}
+	policy = genl_policy_compile(spec, typename, 0);
+	Py_DECREF(typename);
+	if (!policy) {
+		return NULL;
+	}
+
+	genl_policy_free(family_policy[slot].policy);
+	family_policy[slot].family_id = family_id;
+	family_policy[slot].policy = policy;
+	Py_RETURN_TRUE;
+}
+
+
+// encode(family_id, attrs) ==> bytes
+static PyObject * py_genl_encode(PyObject *self, PyObject *args)
+{
+	int family_id;
+	PyObject *obj;
+	genl_policy_t *policy;
+	char buf[MAX_MSG_SIZE];
+	size_t len = 0;
+
+	if (!PyArg_ParseTuple(args, "iO", &family_id, &obj)) {
+		return NULL;
+	}
+
+	policy = genl_policy_lookup(family_id);
+	if (!policy) {
+		return NULL;
+	}
+
+	if (genl_encode_obj(policy, obj, buf, sizeof(buf), &len) < 0) {
+		return NULL;
+	}
+
+	return PyBytes_FromStringAndSize(buf, (Py_ssize_t)len);
+}
+
+
+// decode(family_id, data[, as_tuple=False]) ==> dict/namedtuple
+static PyObject * py_genl_decode(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int family_id;
+	int as_tuple = 0;
+	Py_buffer view;
+	genl_policy_t *policy;
+	PyObject *result;
+	static char *kwlist[] = {"family_id", "data", "as_tuple", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "is*|i", kwlist, &family_id, &view, &as_tuple)) {
+		return NULL;
+	}
+
+	policy = genl_policy_lookup(family_id);
+	if (!policy) {
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+
+	result = genl_decode_stream(policy, view.buf, (size_t)view.len, as_tuple);
+	PyBuffer_Release(&view);
+	return result;
+}
+
+
+// send_attrs(sock, family_id, attrs[, cmd=DOC_EXMPL_C_ECHO]) ==> True(success)/False(failure)
+static PyObject * py_genl_send_attrs(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int sock;
+	int family_id;
+	int cmd = DOC_EXMPL_C_ECHO;
+	PyObject *obj;
+	genl_policy_t *policy;
+	int ret;
+	static char *kwlist[] = {"sock", "family_id", "attrs", "cmd", NULL};
 
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "iiO|i", kwlist, &sock, &family_id, &obj, &cmd)) {
+		return NULL;
+	}
 
-	if (nlmsg_type == 0) {
-		return 0;
+	policy = genl_policy_lookup(family_id);
+	if (!policy) {
+		return NULL;
 	}
 
-	msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
-	msg.n.nlmsg_type = nlmsg_type;
-	msg.n.nlmsg_flags = NLM_F_REQUEST;
-	msg.n.nlmsg_seq = 0;
-	/*
-	 * nlmsg_pid是发送进程的端口号。
-	 * Linux内核不关心这个字段，仅用于跟踪消息。
-	 */
-	msg.n.nlmsg_pid = nlmsg_pid;
-	msg.g.cmd = genl_cmd;
-	msg.g.version = genl_version;
-	na = (struct nlattr *) GENLMSG_DATA(&msg);
-	na->nla_type = nla_type;
-	na->nla_len = nla_len + 1 + NLA_HDRLEN;
-	memcpy(NLA_DATA(na), nla_data, nla_len);
-	msg.n.nlmsg_len += NLMSG_ALIGN(na->nla_len);
+	ret = genl_send_attrs(sock, family_id, (u_int8_t)cmd, policy, obj);
+	if (ret == -2) {
+		return NULL;
+	}
+	if (!ret)
+		Py_RETURN_TRUE;
+	else
+		Py_RETURN_FALSE;
+}
 
-	buf = (char *) &msg;
-	buflen = msg.n.nlmsg_len ;
-	memset(&nladdr, 0, sizeof(nladdr));
-	nladdr.nl_family = AF_NETLINK;
-	while ((r = sendto(sd, buf, buflen, 0, (struct sockaddr *) &nladdr
-				, sizeof(nladdr))) < buflen) {
-		if (r > 0) {
-			buf += r;
-			buflen -= r;
-		} else if (errno != EAGAIN) {
-			return -1;
-		}
+
+// recv_attrs(sock, family_id[, as_tuple=False]) ==> dict/namedtuple/None
+static PyObject * py_genl_recv_attrs(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int sock;
+	int family_id;
+	int as_tuple = 0;
+	int len;
+	genl_policy_t *policy;
+	msgtemplate_t msg;
+	static char *kwlist[] = {"sock", "family_id", "as_tuple", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "ii|i", kwlist, &sock, &family_id, &as_tuple)) {
+		return NULL;
 	}
-	return 0;
+
+	policy = genl_policy_lookup(family_id);
+	if (!policy) {
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	len = genl_recv_nlmsg(family_id, sock, &msg);
+	Py_END_ALLOW_THREADS
+	if (len < 0) {
+		Py_RETURN_NONE;
+	}
+
+	return genl_decode_stream(policy, GENLMSG_DATA(&msg), (size_t)len, as_tuple);
 }
 
 
-static int genl_get_family_id(int sd, char *family_name)
+// dump(sock, family_id[, cmd=DOC_EXMPL_C_DUMP, as_tuple=False]) ==> iterator/None
+// The iterator yields the decoded attributes if a policy is registered for the
+// family, or the raw attribute stream.
+static PyObject * py_genl_dump(PyObject *self, PyObject *args, PyObject *keywds)
 {
-	msgtemplate_t ans;
-	int id;
-	struct nlattr *na;
-	int rep_len;
+	int sock;
+	int family_id;
+	int cmd = DOC_EXMPL_C_DUMP;
+	int as_tuple = 0;
+	msgtemplate_t msg;
+	genl_dump_t *it;
+	genl_sock_t *gs;
+	static char *kwlist[] = {"sock", "family_id", "cmd", "as_tuple", NULL};
 
-	genl_send_msg(sd, GENL_ID_CTRL, 0, CTRL_CMD_GETFAMILY, 1,
-			CTRL_ATTR_FAMILY_NAME, (void *)family_name,
-			strlen(family_name)+1);
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "ii|ii", kwlist, &sock, &family_id, &cmd, &as_tuple)) {
+		return NULL;
+	}
 
-	rep_len = recv(sd, &ans, sizeof(ans), 0);
-	if (rep_len < 0) {
-		return 0;
+	gs = genl_sock_get(sock);
+	if (!gs) {
+		return NULL;
 	}
-	if (ans.n.nlmsg_type == NLMSG_ERROR || !NLMSG_OK((&ans.n), rep_len)) {
-		return 0;
+
+	it = PyObject_New(genl_dump_t, &genl_dump_type);
+	if (!it) {
+		return NULL;
+	}
+	it->sock = sock;
+	it->family_id = family_id;
+	it->as_tuple = as_tuple;
+	it->done = 0;
+	it->seq = genl_next_seq(gs);
+	it->syscalls = 0;
+	it->len = 0;
+	it->offset = 0;
+	it->buf = malloc(MAX_DUMP_SIZE);
+	if (!it->buf) {
+		Py_DECREF(it);
+		return PyErr_NoMemory();
 	}
 
-	na = (struct nlattr *) GENLMSG_DATA(&ans);
-	na = (struct nlattr *) ((char *) na + NLA_ALIGN(na->nla_len));
-	if (na->nla_type == CTRL_ATTR_FAMILY_ID) {
-		id = *(__u16 *) NLA_DATA(na);
-	} else {
-		id = 0;
+	genl_put_header(&msg, family_id, NLM_F_DUMP, it->seq, (u_int8_t)cmd);
+	if (genl_send_nlmsg(sock, &msg) < 0) {
+		Py_DECREF(it);
+		Py_RETURN_NONE;
 	}
+	it->syscalls++;
 
-	return id;
+	return (PyObject *)it;
 }
 
 
-int genl_rcv_msg(int fid, int sock, void **data, size_t *len)
+// request(sock, family_id, data[, callback=None, cmd=DOC_EXMPL_C_ECHO]) ==> seq/None(failure)
+// Send a request without waiting for its response. The response is passed to
+// callback(seq, response) by dispatch(), or else returned by response(seq).
+static PyObject * py_genl_request(PyObject *self, PyObject *args, PyObject *keywds)
 {
+	int sock;
+	int family_id;
+	int cmd = DOC_EXMPL_C_ECHO;
 	int ret;
-	struct msgtemplate msg;
+	Py_buffer view;
+	PyObject *callback = Py_None;
+	PyObject *key;
+	genl_sock_t *gs;
 	struct nlattr *na;
+	msgtemplate_t msg;
+	u_int32_t seq;
+	static char *kwlist[] = {"sock", "family_id", "data", "callback", "cmd", NULL};
 
-	ret = recv(sock, &msg, sizeof(msg), 0);
-	if (ret < 0) {
-		return -1;
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "iis*|Oi", kwlist, &sock, &family_id, &view, &callback, &cmd)) {
+		return NULL;
 	}
 
-	if (msg.n.nlmsg_type == NLMSG_ERROR || !NLMSG_OK((&msg.n), ret)) {
-		return -1;
+	gs = genl_sock_get(sock);
+	if (!gs) {
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+	if (view.len + NLA_HDRLEN > (Py_ssize_t)sizeof(msg.data)) {
+		PyBuffer_Release(&view);
+		Py_RETURN_NONE;
 	}
 
-	if (msg.n.nlmsg_type == fid && fid != 0) {
-		na = (struct nlattr *) GENLMSG_DATA(&msg);
-		*data = (char *)NLA_DATA(na);
-		*len = (size_t)na->nla_len - NLA_HDRLEN;
-		return 0;
+	seq = genl_next_seq(gs);
+	genl_put_header(&msg, family_id, 0, seq, (u_int8_t)cmd);
+	na = (struct nlattr *) GENLMSG_DATA(&msg);
+	na->nla_type = DOC_EXMPL_A_MSG;
+	na->nla_len = view.len + NLA_HDRLEN;
+	memcpy(NLA_DATA(na), view.buf, view.len);
+	msg.n.nlmsg_len += NLMSG_ALIGN(na->nla_len);
+	PyBuffer_Release(&view);
+
+	key = PyLong_FromUnsignedLong(seq);
+	if (!key || PyDict_SetItem(gs->pending, key, callback) < 0) {
+		Py_XDECREF(key);
+		return NULL;
 	}
-	else
-		return -1;
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = genl_send_nlmsg(sock, &msg);
+	Py_END_ALLOW_THREADS
+	if (ret < 0) {
+		PyDict_DelItem(gs->pending, key);
+		Py_DECREF(key);
+		Py_RETURN_NONE;
+	}
+
+	return key;
 }
 
 
-static int _py_genl_create(int *sock, int *family_id)
+// response(sock, family_id, seq) ==> response/None
+// Wait for the response of the request `seq`. The responses of the other
+// requests which arrive meanwhile are kept or dispatched to their callbacks.
+static PyObject * py_genl_response(PyObject *self, PyObject *args)
 {
-	int _sock = -1;
-	int _family_id;
-	struct sockaddr_nl local;
+	int sock;
+	int family_id;
+	unsigned long seq;
+	PyObject *key, *value;
+	genl_sock_t *gs;
+	int ret;
 
-	// Create Generic Netlink Socket.
-	errno = 0;
-	_sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
-	if (_sock < 0) {
-		printf("Failed to create genl socket: %s", strerror(errno));
-		goto error;
+	if (!PyArg_ParseTuple(args, "iik", &sock, &family_id, &seq)) {
+		return NULL;
 	}
 
-	// Bind to the current pid.
-	memset(&local, 0, sizeof(local));
-	local.nl_family = AF_NETLINK;
-	local.nl_pid = getpid();
+	gs = genl_sock_get(sock);
+	if (!gs) {
+		return NULL;
+	}
 
-	errno = 0;
-	if (bind(_sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
-		printf("Failed to bind genl socket: %s", strerror(errno));
-		goto error;
+	key = PyLong_FromUnsignedLong(seq);
+	if (!key) {
+		return NULL;
 	}
 
-	// Get family id
-	_family_id = genl_get_family_id(_sock, "DOC_EXMPL");
+	for (;;) {
+		value = PyDict_GetItem(gs->ready, key);
+		if (value) {
+			Py_INCREF(value);
+			PyDict_DelItem(gs->ready, key);
+			Py_DECREF(key);
+			return value;
+		}
 
-	*sock = _sock;
-	*family_id = _family_id;
-	return 0;
+		// Unknown, or answered through a callback.
+		value = PyDict_GetItem(gs->pending, key);
+		if (!value || value != Py_None) {
+			break;
+		}
 
-error:
-	if (_sock >= 0) {
-		close(_sock);
+		ret = genl_pipeline_recv(sock, family_id, gs, 0);
+		if (ret == -2) {
+			Py_DECREF(key);
+			return NULL;
+		}
+		if (ret == -1 && errno != EINTR) {
+			break;
+		}
+		if (ret == -1 && PyErr_CheckSignals()) {
+			Py_DECREF(key);
+			return NULL;
+		}
 	}
-	return -1;
+
+	Py_DECREF(key);
+	Py_RETURN_NONE;
 }
 
 
-static int _py_genl_recv(int sock, int family_id, void **data, size_t *size)
+// dispatch(sock, family_id[, block=True]) ==> number of responses/None(failure)
+// Receive the responses which have arrived, waiting for the first one if
+// `block`, and pass them to their callbacks.
+static PyObject * py_genl_dispatch(PyObject *self, PyObject *args, PyObject *keywds)
 {
-	return genl_rcv_msg(family_id, sock, data, size);
+	int sock;
+	int family_id;
+	int block = 1;
+	int ret, n = 0;
+	genl_sock_t *gs;
+	static char *kwlist[] = {"sock", "family_id", "block", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "ii|i", kwlist, &sock, &family_id, &block)) {
+		return NULL;
+	}
+
+	gs = genl_sock_get(sock);
+	if (!gs) {
+		return NULL;
+	}
+
+	if (block && PyDict_Size(gs->pending) > 0) {
+		ret = genl_pipeline_recv(sock, family_id, gs, 0);
+		if (ret == -2) {
+			return NULL;
+		}
+		if (ret == -1 && errno != EINTR) {
+			Py_RETURN_NONE;
+		}
+		n += ret > 0 ? ret : 0;
+	}
+
+	while ((ret = genl_pipeline_recv(sock, family_id, gs, MSG_DONTWAIT)) >= 0) {
+		n += ret;
+	}
+	if (ret == -2) {
+		return NULL;
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		Py_RETURN_NONE;
+	}
+
+	return Py_BuildValue("i", n);
 }
 
-static int _py_genl_send(int sock, int family_id, char *data, size_t size)
+
+// inflight(sock) ==> the number of requests still waiting for the response
+static PyObject * py_genl_inflight(PyObject *self, PyObject *args)
 {
-	return genl_send_msg(sock, family_id, getpid(), DOC_EXMPL_C_ECHO, 1,
-			DOC_EXMPL_A_MSG, data, size);
+	int sock;
+	genl_sock_t *gs;
+
+	if (!PyArg_ParseTuple(args, "i", &sock)) {
+		return NULL;
+	}
+
+	gs = genl_sock_get(sock);
+	if (!gs) {
+		return NULL;
+	}
+
+	return Py_BuildValue("n", PyDict_Size(gs->pending));
 }
 
-////////////////////////////////////////////////////////
 
-// create() ==> (sock, family_id)/None
-static PyObject * py_genl_create(PyObject *self)
+// send_batch(sock, family_id, items) ==> seq/None(failure)
+// Send all the items in one DOC_EXMPL_C_BATCH request; collect the results by recv_batch().
+static PyObject * py_genl_send_batch(PyObject *self, PyObject *args)
 {
-	int sock, family_id;
+	int sock;
+	int family_id;
+	int ret;
+	PyObject *items, *seq;
+	Py_ssize_t i, n;
+	Py_buffer view;
+	struct nlattr *batch;
+	genl_sock_t *gs;
+	msgtemplate_t msg;
+	size_t off = NLA_HDRLEN;
+	u_int32_t nlseq;
 
-	if (_py_genl_create(&sock, &family_id) == -1) {
+	if (!PyArg_ParseTuple(args, "iiO", &sock, &family_id, &items)) {
+		return NULL;
+	}
+
+	gs = genl_sock_get(sock);
+	if (!gs) {
+		return NULL;
+	}
+
+	seq = PySequence_Fast(items, "items must be a sequence");
+	if (!seq) {
+		return NULL;
+	}
+
+	// The items are packed as DOC_EXMPL_A_MSG attributes nested in DOC_EXMPL_A_BATCH.
+	n = PySequence_Fast_GET_SIZE(seq);
+	for (i = 0; i < n; i++) {
+		if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, i), &view, PyBUF_SIMPLE) < 0) {
+			Py_DECREF(seq);
+			return NULL;
+		}
+		ret = genl_put_attr(msg.data, sizeof(msg.data), &off, DOC_EXMPL_A_MSG, view.buf, (size_t)view.len);
+		PyBuffer_Release(&view);
+		if (ret < 0) {
+			Py_DECREF(seq);
+			return NULL;
+		}
+	}
+	Py_DECREF(seq);
+
+	if (off > 0xFFFF) {
+		PyErr_SetString(PyExc_OverflowError, "batch exceeds the attribute size");
+		return NULL;
+	}
+	batch = (struct nlattr *) msg.data;
+	batch->nla_type = DOC_EXMPL_A_BATCH | NLA_F_NESTED;
+	batch->nla_len = off;
+
+	nlseq = genl_next_seq(gs);
+	genl_put_header(&msg, family_id, 0, nlseq, DOC_EXMPL_C_BATCH);
+	msg.n.nlmsg_len += off;
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = genl_send_nlmsg(sock, &msg);
+	Py_END_ALLOW_THREADS
+	if (ret < 0) {
 		Py_RETURN_NONE;
 	}
 
-	return Py_BuildValue("(ii)", sock, family_id);
+	return PyLong_FromUnsignedLong(nlseq);
 }
 
 
-// send(sock, family_id, data, size) ==> True(success)/False(failure)
-static PyObject * py_genl_send(PyObject *self, PyObject *args)
+// recv_batch(sock, family_id, seq) ==> [result, ...]/None(failure)
+// Collect the results of a batch request, which may span several messages,
+// until NLMSG_DONE. The messages of the other requests are dropped.
+static PyObject * py_genl_recv_batch(PyObject *self, PyObject *args)
 {
 	int sock;
 	int family_id;
-	char *data;
-	unsigned long size;
-	int _size;
-	int ret;
-	if (!PyArg_ParseTuple(args, "iiz#k", &sock, &family_id, &data, &_size, &size)) {
-		return Py_BuildValue("i", -2);
-		//return NULL;   // Raise a Exception
+	unsigned long seq;
+	int len, alen;
+	PyObject *results, *value;
+	struct nlmsghdr *nlh;
+	struct nlattr *na;
+	genl_stats_t *st;
+	msgtemplate_t msg;
+
+	if (!PyArg_ParseTuple(args, "iik", &sock, &family_id, &seq)) {
+		return NULL;
 	}
 
-	if (size != _size) {
-		Py_RETURN_FALSE;
+	st = GENL_STATS(sock);
+	results = PyList_New(0);
+	if (!results) {
+		return NULL;
 	}
 
-	ret = _py_genl_send(sock, family_id, data, (size_t)size);
-	if (!ret)
-		Py_RETURN_TRUE;
-	else
-		Py_RETURN_FALSE;
+	for (;;) {
+		Py_BEGIN_ALLOW_THREADS
+		len = genl_recv_counted(sock, &msg, sizeof(msg), 0);
+		Py_END_ALLOW_THREADS
+		if (len < 0) {
+			if (errno == EINTR && !PyErr_CheckSignals())
+				continue;
+			goto error;
+		}
+
+		for (nlh = &msg.n; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != seq) {
+				st->discards++;
+				continue;
+			}
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				return results;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				goto error;
+			}
+			if (nlh->nlmsg_type != family_id || nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) {
+				st->discards++;
+				continue;
+			}
+			st->rx_msgs++;
+			st->rx_bytes += nlh->nlmsg_len;
+
+			alen = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+			na = (struct nlattr *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN);
+			for (; NLA_OK(na, alen); na = NLA_NEXT(na, alen)) {
+				if ((na->nla_type & NLA_TYPE_MASK) != DOC_EXMPL_A_MSG) {
+					continue;
+				}
+				value = PyBytes_FromStringAndSize(NLA_DATA(na), na->nla_len - NLA_HDRLEN);
+				if (!value || PyList_Append(results, value) < 0) {
+					Py_XDECREF(value);
+					Py_DECREF(results);
+					return NULL;
+				}
+				Py_DECREF(value);
+			}
+		}
+	}
+
+error:
+	Py_DECREF(results);
+	if (PyErr_Occurred()) {
+		return NULL;
+	}
+	Py_RETURN_NONE;
 }
 
 
-// recv(sock, family_id)  ===> (byte_num, data)/None
-static PyObject * py_genl_recv(PyObject *self, PyObject *args)
+// resolve_group(sock, family_name, group_name) ==> group_id/None
+static PyObject * py_genl_resolve_group(PyObject *self, PyObject *args)
 {
 	int sock;
+	char *family_name;
+	char *group_name;
+	int group_id = 0;
 	int family_id;
-	char *data;
-	int err;
-	size_t size;
 
-	if (!PyArg_ParseTuple(args, "ii", &sock, &family_id)) {
+	if (!PyArg_ParseTuple(args, "iss", &sock, &family_name, &group_name)) {
 		Py_RETURN_NONE;
 	}
 
-	err = _py_genl_recv(sock, family_id, (void*)&data, &size);
-	if (err < 0) {
+	Py_BEGIN_ALLOW_THREADS
+	family_id = genl_get_family(sock, family_name, group_name, &group_id);
+	Py_END_ALLOW_THREADS
+	if (!family_id || !group_id) {
 		Py_RETURN_NONE;
 	}
 
-	return Py_BuildValue("(Iz#)", size, data, size);
+	return Py_BuildValue("i", group_id);
+}
+
+
+static PyObject * genl_membership(PyObject *args, int option)
+{
+	int sock;
+	unsigned int group;
+
+	if (!PyArg_ParseTuple(args, "iI", &sock, &group)) {
+		Py_RETURN_FALSE;
+	}
+
+	if (setsockopt(sock, SOL_NETLINK, option, &group, sizeof(group)) < 0) {
+		Py_RETURN_FALSE;
+	}
+	Py_RETURN_TRUE;
+}
+
+
+// join(sock, group_id) ==> True(success)/False(failure)
+static PyObject * py_genl_join(PyObject *self, PyObject *args)
+{
+	return genl_membership(args, NETLINK_ADD_MEMBERSHIP);
+}
+
+
+// leave(sock, group_id) ==> True(success)/False(failure)
+static PyObject * py_genl_leave(PyObject *self, PyObject *args)
+{
+	return genl_membership(args, NETLINK_DROP_MEMBERSHIP);
+}
+
+
+// stats(sock[, diag=False]) ==> {counter: value}
+// With diag, also sample rmem_alloc, rcvbuf and drops of the socket through
+// NETLINK_SOCK_DIAG, which are None if the kernel does not support it.
+static PyObject * py_genl_stats(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int sock;
+	int diag = 0;
+	int ret;
+	genl_stats_t st;
+	__u32 meminfo[SK_MEMINFO_VARS];
+	PyObject *result, *values;
+	static char *kwlist[] = {"sock", "diag", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|i", kwlist, &sock, &diag)) {
+		return NULL;
+	}
+	if (sock < 0 || sock >= MAX_FD) {
+		PyErr_SetString(PyExc_ValueError, "more than the max file description");
+		return NULL;
+	}
+	st = genl_stats[sock];
+
+	result = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+			"tx_msgs", st.tx_msgs, "tx_bytes", st.tx_bytes, "tx_syscalls", st.tx_syscalls,
+			"rx_msgs", st.rx_msgs, "rx_bytes", st.rx_bytes, "rx_syscalls", st.rx_syscalls,
+			"eagain", st.eagain, "enobufs", st.enobufs, "errors", st.errors,
+			"discards", st.discards);
+	if (!result || !diag) {
+		return result;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = genl_diag_meminfo(sock, NETLINK_GENERIC, meminfo);
+	Py_END_ALLOW_THREADS
+	if (ret < 0) {
+		values = Py_BuildValue("{s:O,s:O,s:O}", "rmem_alloc", Py_None, "rcvbuf", Py_None,
+				"drops", Py_None);
+	} else {
+		values = Py_BuildValue("{s:I,s:I,s:I}", "rmem_alloc", meminfo[SK_MEMINFO_RMEM_ALLOC],
+				"rcvbuf", meminfo[SK_MEMINFO_RCVBUF], "drops", meminfo[SK_MEMINFO_DROPS]);
+	}
+	if (!values || PyDict_Update(result, values) < 0) {
+		Py_XDECREF(values);
+		Py_DECREF(result);
+		return NULL;
+	}
+	Py_DECREF(values);
+	return result;
 }
 
 
@@ -278,8 +1994,10 @@ static PyObject * py_genl_close(PyObject *self, PyObject *args)
 		Py_RETURN_NONE;
 	}
 
-	if (sock >= 0)
+	if (sock >= 0) {
+		genl_sock_release(sock);
 		close(sock);
+	}
 
 	Py_RETURN_NONE;
 }
@@ -287,17 +2005,58 @@ static PyObject * py_genl_close(PyObject *self, PyObject *args)
 
 static PyMethodDef GENLMethods[] = {
 	{"create", (PyCFunction)py_genl_create, METH_VARARGS, "Create a generic netlink socket"},
-	{"send", (PyCFunction)py_genl_send, METH_VARARGS|METH_KEYWORDS, "Send a message to the kernle."},
+	{"send", (PyCFunction)py_genl_send, METH_VARARGS, "Send a message to the kernle."},
 	{"recv", (PyCFunction)py_genl_recv, METH_VARARGS, "Receive a message from the kernle"},
 	{"close", (PyCFunction)py_genl_close, METH_VARARGS, "Close the generic netlink socket"},
+	{"register_policy", (PyCFunction)py_genl_register_policy, METH_VARARGS|METH_KEYWORDS, "Compile and register the attribute policy of a family"},
+	{"encode", (PyCFunction)py_genl_encode, METH_VARARGS, "Encode the attributes into a TLV stream"},
+	{"decode", (PyCFunction)py_genl_decode, METH_VARARGS|METH_KEYWORDS, "Decode a TLV stream into the attributes"},
+	{"send_attrs", (PyCFunction)py_genl_send_attrs, METH_VARARGS|METH_KEYWORDS, "Encode the attributes and send them to the kernel"},
+	{"recv_attrs", (PyCFunction)py_genl_recv_attrs, METH_VARARGS|METH_KEYWORDS, "Receive a message and decode its attributes"},
+	{"dump", (PyCFunction)py_genl_dump, METH_VARARGS|METH_KEYWORDS, "Request a dump and iterate over its messages"},
+	{"request", (PyCFunction)py_genl_request, METH_VARARGS|METH_KEYWORDS, "Send a request without waiting for the response"},
+	{"response", (PyCFunction)py_genl_response, METH_VARARGS, "Wait for the response of a request"},
+	{"dispatch", (PyCFunction)py_genl_dispatch, METH_VARARGS|METH_KEYWORDS, "Pass the arrived responses to their callbacks"},
+	{"inflight", (PyCFunction)py_genl_inflight, METH_VARARGS, "The number of requests in flight"},
+	{"send_batch", (PyCFunction)py_genl_send_batch, METH_VARARGS, "Send many items in one batch request"},
+	{"recv_batch", (PyCFunction)py_genl_recv_batch, METH_VARARGS, "Receive all the results of a batch request"},
+	{"resolve_group", (PyCFunction)py_genl_resolve_group, METH_VARARGS, "Resolve the id of a multicast group of a family"},
+	{"join", (PyCFunction)py_genl_join, METH_VARARGS, "Join a multicast group"},
+	{"leave", (PyCFunction)py_genl_leave, METH_VARARGS, "Leave a multicast group"},
+	{"stats", (PyCFunction)py_genl_stats, METH_VARARGS|METH_KEYWORDS, "The counters of a socket"},
+	{NULL, NULL, 0, NULL},
 };
 
 
+static void genl_add_constants(PyObject *m)
+{
+	if (!m) {
+		return;
+	}
+
+	PyModule_AddIntConstant(m, "NLA_U8", GENL_CODEC_U8);
+	PyModule_AddIntConstant(m, "NLA_U16", GENL_CODEC_U16);
+	PyModule_AddIntConstant(m, "NLA_U32", GENL_CODEC_U32);
+	PyModule_AddIntConstant(m, "NLA_U64", GENL_CODEC_U64);
+	PyModule_AddIntConstant(m, "NLA_STRING", GENL_CODEC_STRING);
+	PyModule_AddIntConstant(m, "NLA_NUL_STRING", GENL_CODEC_NUL_STRING);
+	PyModule_AddIntConstant(m, "NLA_BINARY", GENL_CODEC_BINARY);
+	PyModule_AddIntConstant(m, "NLA_NESTED", GENL_CODEC_NESTED);
+
+	PyModule_AddIntConstant(m, "DOC_EXMPL_C_ECHO", DOC_EXMPL_C_ECHO);
+	PyModule_AddIntConstant(m, "DOC_EXMPL_C_DUMP", DOC_EXMPL_C_DUMP);
+	PyModule_AddIntConstant(m, "DOC_EXMPL_C_NOTIFY", DOC_EXMPL_C_NOTIFY);
+	PyModule_AddIntConstant(m, "DOC_EXMPL_C_BATCH", DOC_EXMPL_C_BATCH);
+}
+
+
 #if PYTHON_ABI_VERSION < 3
 /// For Python2
 void initgenl(void)
 {
-	(void)Py_InitModule("genl", GENLMethods);
+	if (PyType_Ready(&genl_dump_type) < 0)
+		return;
+	genl_add_constants(Py_InitModule("genl", GENLMethods));
 }
 #else
 /// For Python3
@@ -312,7 +2071,12 @@ static struct PyModuleDef GENLModule = {
 PyMODINIT_FUNC
 PyInit_genl()
 {
-        return PyModule_Create(&GENLModule);
+        PyObject *m;
+
+        if (PyType_Ready(&genl_dump_type) < 0)
+                return NULL;
+        m = PyModule_Create(&GENLModule);
+        genl_add_constants(m);
+        return m;
 }
 #endif
-
@@ -139,12 +139,29 @@
 #include <linux/module.h>
 #include <linux/string.h>
 #include <linux/kernel.h>
+#include <linux/vmalloc.h>
 #include <linux/genetlink.h>
 #include <net/genetlink.h>
 
+#define CREATE_TRACE_POINTS
+#include "test_genl_trace.h"
+
 
 /////
-extern int genl_send_msg_to_user(void *data, int len, int pid);
+extern int genl_send_msg_to_user(struct net *net, void *data, int len, int pid, u32 seq);
+extern int genl_send_event(void *data, int len, gfp_t flags);
+extern int genl_send_event_net(struct net *net, void *data, int len, gfp_t flags);
+
+// The table which is streamed to the userspace by DOC_EXMPL_C_DUMP.
+static unsigned int table_size = 100000;
+module_param(table_size, uint, 0444);
+MODULE_PARM_DESC(table_size, "The number of entries dumped by DOC_EXMPL_C_DUMP");
+
+static u64 *doc_exmpl_table;
+
+static bool debug = false;
+module_param(debug, bool, 0644);
+MODULE_PARM_DESC(debug, "Log every echoed message");
 
 
 ////////////////////////////////////
@@ -154,22 +171,43 @@ extern int genl_send_msg_to_user(void *data, int len, int pid);
 enum {
 	DOC_EXMPL_A_UNSPEC,
 	DOC_EXMPL_A_MSG,
+	DOC_EXMPL_A_INDEX,
+	DOC_EXMPL_A_VALUE,
+	DOC_EXMPL_A_BATCH,
 	__DOC_EXMPL_A_MAX,
 };
 #define DOC_EXMPL_A_MAX (__DOC_EXMPL_A_MAX - 1)
 
 // 2. attribute policy
 static struct nla_policy doc_exmpl_genl_policy[DOC_EXMPL_A_MAX + 1] = {
-	[DOC_EXMPL_A_MSG] = { .type = NLA_NUL_STRING },
+	// 任意的二进制负载，长度由属性头给出，不需要以NULL结尾。
+	[DOC_EXMPL_A_MSG] = { .type = NLA_BINARY },
+	[DOC_EXMPL_A_INDEX] = { .type = NLA_U32 },
+	[DOC_EXMPL_A_VALUE] = { .type = NLA_U64 },
+	[DOC_EXMPL_A_BATCH] = { .type = NLA_NESTED },
+};
+
+// 3. multicast groups
+// 组号相对于family；用户空间通过 Controller 查询 "events" 组的全局ID，然后加入该组。
+enum {
+	DOC_EXMPL_MCGRP_EVENTS,
 };
 
-// 3. family definition
+static const struct genl_multicast_group doc_exmpl_genl_mcgrps[] = {
+	[DOC_EXMPL_MCGRP_EVENTS] = { .name = "events" },
+};
+
+// 4. family definition
 static struct genl_family doc_exmpl_genl_family = {
 	.id = GENL_ID_GENERATE,
 	.hdrsize = 0,
 	.name = "DOC_EXMPL",
 	.version = 1,
 	.maxattr = DOC_EXMPL_A_MAX,
+	// 不持有全局的 genl_mutex，允许处理器在多个CPU上并行运行。
+	.parallel_ops = true,
+	// 在所有网络命名空间中可用；回复和事件发送到请求者所在的命名空间。
+	.netnsok = true,
 };
 
 ////////////////////////////////////
@@ -179,37 +217,169 @@ static struct genl_family doc_exmpl_genl_family = {
 // Return 0 on success, negative values on failure.
 static int doc_exmpl_echo(struct sk_buff *skb, struct genl_info *info)
 {
-	// doit 没有运行在中断上下文.
-	struct nlmsghdr     *nlhdr;
-	struct genlmsghdr   *genlhdr;
-	struct nlattr       *nlh;
+	// doit 没有运行在中断上下文，因此回复可以使用 GFP_KERNEL 分配。
+	// 由于 parallel_ops，doit 可能在多个CPU上并发运行，不能修改无保护的共享状态。
+	struct nlattr *na;
 	void *data;
+	int len;
 
-	nlhdr = nlmsg_hdr(skb);
-	genlhdr = nlmsg_data(nlhdr);
-	nlh = genlmsg_data(genlhdr);
-	data = nla_data(nlh);
+	// The attributes have been validated against doc_exmpl_genl_policy.
+	na = info->attrs[DOC_EXMPL_A_MSG];
+	if (!na)
+		return -EINVAL;
+	data = nla_data(na);
+	len = nla_len(na);
 
 	// Handler the message here.
 	// TODO:)
-	pr_info("====== %s\n", (char *)data);
+	if (unlikely(debug))
+		pr_info("====== %d bytes: %*ph\n", len, min(len, 64), data);
+	// The reply carries the request's seq, so that the userspace can match it
+	// while many requests are in flight.
 	// For kernel 3.8 above
-	genl_send_msg_to_user(data, strlen(data)+1, info->snd_portid);
+	genl_send_msg_to_user(genl_info_net(info), data, len, info->snd_portid, info->snd_seq);
 	// For kernel 3.8 below
-	//genl_send_msg_to_user(data, strlen(data)+1, info->snd_pid);
+	//genl_send_msg_to_user(genl_info_net(info), data, len, info->snd_pid, info->snd_seq);
 
 	return 0;
 }
 
+// Multicast the message to every listener of the "events" group in the
+// namespace of the sender.
+static int doc_exmpl_notify(struct sk_buff *skb, struct genl_info *info)
+{
+	struct nlattr *na;
+
+	na = info->attrs[DOC_EXMPL_A_MSG];
+	if (!na)
+		return -EINVAL;
+
+	return genl_send_event_net(genl_info_net(info), nla_data(na), nla_len(na), GFP_KERNEL);
+}
+
 // 2. commands
 enum {
 	DOC_EXMPL_C_UNSPEC,
 	DOC_EXMPL_C_ECHO,
+	DOC_EXMPL_C_DUMP,
+	DOC_EXMPL_C_NOTIFY,
+	DOC_EXMPL_C_BATCH,
 	__DOC_EXMPL_C_MAX,
 };
 #define DOC_EXMPL_C_MAX (__DOC_EXMPL_C_MAX - 1)
 
-// 3. operation definition
+// Start a reply of DOC_EXMPL_C_BATCH which has room for at least `size` bytes of attributes.
+// A reply takes as many items as a page-sized skb holds, or one larger item.
+static struct sk_buff *doc_exmpl_batch_new(struct genl_info *info, size_t size)
+{
+	struct sk_buff *skb;
+
+	skb = genlmsg_new(max_t(size_t, size, NLMSG_GOODSIZE), GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	// For kernel 3.8 below, use info->snd_pid
+	if (!genlmsg_put(skb, info->snd_portid, info->snd_seq, &doc_exmpl_genl_family,
+			NLM_F_MULTI, DOC_EXMPL_C_BATCH)) {
+		kfree_skb(skb);
+		return NULL;
+	}
+	return skb;
+}
+
+// Finish and unicast a reply of DOC_EXMPL_C_BATCH. The skb is always consumed.
+static int doc_exmpl_batch_send(struct genl_info *info, struct sk_buff *skb)
+{
+	genlmsg_end(skb, genlmsg_data(nlmsg_data(nlmsg_hdr(skb))));
+	return genlmsg_unicast(genl_info_net(info), skb, info->snd_portid);
+}
+
+// 3. batch handler
+// 请求的 DOC_EXMPL_A_BATCH 中嵌套了多个 DOC_EXMPL_A_MSG，逐个处理后把结果尽量多地
+// 打包进同一个skb；一个skb装不下时发送它并开始下一个。所有回复都是 NLM_F_MULTI
+// 消息，最后以 NLMSG_DONE 结束。
+// 注意：doit 在发送者的上下文中同步运行，全部回复必须能放进请求者的接收缓冲区。
+static int doc_exmpl_batch(struct sk_buff *skb, struct genl_info *info)
+{
+	struct nlattr *batch, *item;
+	struct sk_buff *reply = NULL;
+	struct nlmsghdr *nlh;
+	int rem, err;
+
+	batch = info->attrs[DOC_EXMPL_A_BATCH];
+	if (!batch)
+		return -EINVAL;
+
+	nla_for_each_nested(item, batch, rem) {
+		if (nla_type(item) != DOC_EXMPL_A_MSG)
+			continue;
+
+		// Handler the item here. The result is the item itself.
+		if (reply && nla_put(reply, DOC_EXMPL_A_MSG, nla_len(item), nla_data(item))) {
+			err = doc_exmpl_batch_send(info, reply);
+			reply = NULL;
+			if (err < 0)
+				return err;
+		}
+		if (!reply) {
+			reply = doc_exmpl_batch_new(info, nla_total_size(nla_len(item)));
+			if (!reply)
+				return -ENOMEM;
+			if (nla_put(reply, DOC_EXMPL_A_MSG, nla_len(item), nla_data(item))) {
+				kfree_skb(reply);
+				return -EMSGSIZE;
+			}
+		}
+	}
+
+	if (reply) {
+		err = doc_exmpl_batch_send(info, reply);
+		if (err < 0)
+			return err;
+	}
+
+	// Terminate the multipart reply.
+	reply = nlmsg_new(0, GFP_KERNEL);
+	if (!reply)
+		return -ENOMEM;
+	nlh = nlmsg_put(reply, info->snd_portid, info->snd_seq, NLMSG_DONE, 0, NLM_F_MULTI);
+	if (!nlh) {
+		kfree_skb(reply);
+		return -EMSGSIZE;
+	}
+	nlmsg_end(reply, nlh);
+	return genlmsg_unicast(genl_info_net(info), reply, info->snd_portid);
+}
+
+// 4. dump handler
+// dumpit 会被反复调用，每次尽可能多地填满一个skb，直到返回 0（此时内核发送
+// NLMSG_DONE）。cb->args[0] 保存下一次要发送的表项索引，用于跨skb续传。
+static int doc_exmpl_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	unsigned long idx = cb->args[0];
+	void *hdr;
+
+	for (; idx < table_size; idx++) {
+		// For kernel 3.8 below, use NETLINK_CB(cb->skb).pid
+		hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+				&doc_exmpl_genl_family, NLM_F_MULTI, DOC_EXMPL_C_DUMP);
+		if (!hdr)
+			break;
+
+		if (nla_put_u32(skb, DOC_EXMPL_A_INDEX, idx) ||
+		    nla_put_u64(skb, DOC_EXMPL_A_VALUE, doc_exmpl_table[idx])) {
+			genlmsg_cancel(skb, hdr);
+			break;
+		}
+
+		genlmsg_end(skb, hdr);
+	}
+
+	cb->args[0] = idx;
+	return skb->len;
+}
+
+// 5. operation definition
 static struct genl_ops doc_exmpl_genl_ops[] = {
 	{
 		.cmd = DOC_EXMPL_C_ECHO,
@@ -218,6 +388,28 @@ static struct genl_ops doc_exmpl_genl_ops[] = {
 		.doit = doc_exmpl_echo,
 		.dumpit = NULL,
 	},
+	{
+		.cmd = DOC_EXMPL_C_DUMP,
+		.flags = 0,
+		.policy = doc_exmpl_genl_policy,
+		.doit = NULL,
+		.dumpit = doc_exmpl_dump,
+	},
+	{
+		.cmd = DOC_EXMPL_C_NOTIFY,
+		// Only CAP_NET_ADMIN may multicast to every listener.
+		.flags = GENL_ADMIN_PERM,
+		.policy = doc_exmpl_genl_policy,
+		.doit = doc_exmpl_notify,
+		.dumpit = NULL,
+	},
+	{
+		.cmd = DOC_EXMPL_C_BATCH,
+		.flags = 0,
+		.policy = doc_exmpl_genl_policy,
+		.doit = doc_exmpl_batch,
+		.dumpit = NULL,
+	},
 };
 
 /////////////////////////////////////
@@ -226,9 +418,10 @@ static struct genl_ops doc_exmpl_genl_ops[] = {
 static int doc_exmpl_genl_reg(void)
 {
 	// 3st and 4st
-	// For kernel 3.8 below
+	// For kernel 3.8 below, register the groups one by one with genl_register_mc_group().
 	//return genl_register_family_with_ops(&doc_exmpl_genl_family, doc_exmpl_genl_ops, sizeof(doc_exmpl_genl_ops));
-	return genl_register_family_with_ops(&doc_exmpl_genl_family, doc_exmpl_genl_ops);
+	return genl_register_family_with_ops_groups(&doc_exmpl_genl_family, doc_exmpl_genl_ops,
+			doc_exmpl_genl_mcgrps);
 }
 
 
@@ -238,78 +431,139 @@ static int doc_exmpl_genl_unreg(void)
 }
 
 
+// Build a DOC_EXMPL message which carries `data` as DOC_EXMPL_A_MSG.
+static struct sk_buff *doc_exmpl_build_msg(void *data, int len, u32 pid, u32 seq, u8 cmd, gfp_t flags)
+{
+	struct sk_buff *skb;
+	void *head;
+
+	// Create a new netlink msg, the size is the total length of attribute including padding
+	skb = genlmsg_new(nla_total_size(len), flags);
+	if (!skb) {
+		return NULL;
+	}
+
+	// Add a new netlink message to an skb
+	head = genlmsg_put(skb, pid, seq, &doc_exmpl_genl_family, 0, cmd);
+	if (!head) {
+		goto error;
+	}
+
+	// Add a netlink attribute to a socket buffer
+	if (nla_put(skb, DOC_EXMPL_A_MSG, len, data)) {
+		goto error;
+	}
+
+	if (genlmsg_end(skb, head) < 0) {
+		goto error;
+	}
+
+	return skb;
+
+error:
+	kfree_skb(skb);
+	return NULL;
+}
+
+
 /**
  * * genl_send_msg_to_user - 通过generic netlink发送数据到netlink
  * *
+ * * @net:  客户端所在的网络命名空间，应为请求的 genl_info_net(info)
  * * @data: 发送数据缓存
  * * @len:  数据长度 单位：byte
  * * @pid:  发送到的客户端pid 这个pid要从用户空间发来数据触发的doit中的info->snd_pid参数获得
+ * * @seq:  回复的序列号，应为请求的 info->snd_seq
  * *
  * * return:
  * *    =0:       成功
  * *    <0:       失败
  * */
-int genl_send_msg_to_user(void *data, int len, int pid)
+int genl_send_msg_to_user(struct net *net, void *data, int len, int pid, u32 seq)
 {
 	struct sk_buff *skb;
-	size_t size;
-	void *head;
 	int err;
 
-	// Calculate total length of attribute including padding
-	size = nla_total_size(len);
-
-	// Create a new netlink msg
-	skb = genlmsg_new(size, GFP_KERNEL);
+	trace_doc_exmpl_reply_start(DOC_EXMPL_C_ECHO, len, pid, seq);
+	skb = doc_exmpl_build_msg(data, len, pid, seq, DOC_EXMPL_C_ECHO, GFP_KERNEL);
 	if (!skb) {
 		err = -ENOMEM;
-		goto skb_error;
+	} else {
+		// genlmsg_unicast 总是会消耗掉skb，失败时也不能再释放。
+		err = genlmsg_unicast(net, skb, pid);
 	}
+	trace_doc_exmpl_reply_end(DOC_EXMPL_C_ECHO, len, pid, seq, err);
 
-	// Add a new netlink message to an skb
-	head = genlmsg_put(skb, pid, 0, &doc_exmpl_genl_family, 0, DOC_EXMPL_C_ECHO);
-	if (!head) {
-		err = -1;
-		goto error;
-	}
+	return err;
+}
 
-	// Add a netlink attribute to a socket buffer
-	err = nla_put(skb, DOC_EXMPL_A_MSG, len, data);
-	if (err) {
-		goto error;
-	}
 
-	head = genlmsg_data(nlmsg_data(nlmsg_hdr(skb)));
+/**
+ * * genl_send_event_net - 向网络命名空间 net 中的 "events" 多播组发送一个事件
+ * *
+ * * 内核只发送一次，由netlink把skb分发给组内的所有监听者。
+ * *
+ * * @net:   监听者所在的网络命名空间
+ * * @data:  发送数据缓存
+ * * @len:   数据长度 单位：byte
+ * * @flags: 分配skb使用的gfp标志，在原子上下文中应为 GFP_ATOMIC
+ * *
+ * * return:
+ * *    =0:       成功（包括没有任何监听者）
+ * *    <0:       失败
+ * */
+int genl_send_event_net(struct net *net, void *data, int len, gfp_t flags)
+{
+	struct sk_buff *skb;
+	int err;
 
-	err = genlmsg_end(skb, head);
-	if (err < 0) {
-		goto error;
+	skb = doc_exmpl_build_msg(data, len, 0, 0, DOC_EXMPL_C_NOTIFY, flags);
+	if (!skb) {
+		return -ENOMEM;
 	}
 
-	err = genlmsg_unicast(&init_net, skb, pid);
-	if (err < 0) {
-		goto error;
+	// For kernel 3.13 below, use genlmsg_multicast_netns(net, skb, 0, group_id, flags)
+	// with the global group id instead of DOC_EXMPL_MCGRP_EVENTS.
+	err = genlmsg_multicast_netns(&doc_exmpl_genl_family, net, skb, 0, DOC_EXMPL_MCGRP_EVENTS, flags);
+	if (err == -ESRCH) {
+		// No listener.
+		err = 0;
 	}
-
-	return 0;
-
-error:
-	kfree_skb(skb);
-skb_error:
 	return err;
 }
+EXPORT_SYMBOL(genl_send_event_net);
+
+// genl_send_event - 与 genl_send_event_net 相同，发送到 &init_net
+int genl_send_event(void *data, int len, gfp_t flags)
+{
+	return genl_send_event_net(&init_net, data, len, flags);
+}
+EXPORT_SYMBOL(genl_send_event);
 
 
 static int __init doc_exmpl_genl_init(void)
 {
+	unsigned int i;
+	int err;
+
+	doc_exmpl_table = vmalloc(sizeof(*doc_exmpl_table) * max(table_size, 1U));
+	if (!doc_exmpl_table)
+		return -ENOMEM;
+	for (i = 0; i < table_size; i++)
+		doc_exmpl_table[i] = (u64)i * i;
+
 	pr_info("Register DOC_EXMPL Generic Netlink\n");
-	return doc_exmpl_genl_reg();
+	err = doc_exmpl_genl_reg();
+	if (err)
+		vfree(doc_exmpl_table);
+	return err;
 }
 
 static void __exit doc_exmpl_genl_exit(void)
 {
 	pr_info("Unregister DOC_EXMPL Generic Netlink\n");
 	doc_exmpl_genl_unreg();
+	vfree(doc_exmpl_table);
 }
 
 module_init(doc_exmpl_genl_init);
@@ -2,14 +2,35 @@ from __future__ import print_function
 
 import genl
 
-data = "\x40\x40\x40\x00"
+data = b"\x40\x00\x40\x00"
 size = 4
 
 sock, fid = genl.create()
 print("Sent %s" % genl.send(sock, fid, data, size))
 num, data = genl.recv(sock, fid)
 print("Recv %s:%s:%s" % (num, len(data), data))
-for i in data:
-    print("%X" % ord(i))
+for i in bytearray(data):
+    print("%X" % i)
+
+genl.register_policy(fid, [("msg", genl.NLA_BINARY),
+                           ("index", genl.NLA_U32),
+                           ("value", genl.NLA_U64)])
+print("Sent %s" % genl.send_attrs(sock, fid, {"msg": b"@@@"}))
+print("Recv %s" % (genl.recv_attrs(sock, fid),))
+
+seqs = [genl.request(sock, fid, b"@\x00@") for _ in range(8)]
+print("Recv %s" % [genl.response(sock, fid, seq) for seq in reversed(seqs)])
+
+seq = genl.send_batch(sock, fid, [("item%d" % i).encode() for i in range(1000)])
+print("Recv %d batch results" % len(genl.recv_batch(sock, fid, seq)))
+
+entries = genl.dump(sock, fid)
+print("Dumped %d entries in %d syscalls" % (sum(1 for _ in entries), entries.syscalls))
+
+group = genl.resolve_group(sock, "DOC_EXMPL", "events")
+print("Join %s: %s" % (group, genl.join(sock, group)))
+# DOC_EXMPL_C_NOTIFY needs CAP_NET_ADMIN.
+print("Sent %s" % genl.send(sock, fid, b"!!!", 3, genl.DOC_EXMPL_C_NOTIFY))
+print("Event %s" % (genl.recv_attrs(sock, fid),))
 genl.close(sock)
 
@@ -0,0 +1,75 @@
+/*
+ * Tracepoints of test_genl.
+ *
+ * doc_exmpl_reply_start and doc_exmpl_reply_end surround the unicast of a
+ * reply, e.g. the echo of doc_exmpl_echo. Enable them with
+ *     perf record -e 'test_genl:*' -a
+ * They cost nothing but a static branch while disabled.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM test_genl
+
+#if !defined(_TEST_GENL_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TEST_GENL_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(doc_exmpl_reply_start,
+
+	TP_PROTO(u8 cmd, int len, u32 portid, u32 seq),
+
+	TP_ARGS(cmd, len, portid, seq),
+
+	TP_STRUCT__entry(
+		__field(u8, cmd)
+		__field(int, len)
+		__field(u32, portid)
+		__field(u32, seq)
+	),
+
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->len = len;
+		__entry->portid = portid;
+		__entry->seq = seq;
+	),
+
+	TP_printk("cmd=%u len=%d portid=%u seq=%u", __entry->cmd, __entry->len,
+		__entry->portid, __entry->seq)
+);
+
+TRACE_EVENT(doc_exmpl_reply_end,
+
+	TP_PROTO(u8 cmd, int len, u32 portid, u32 seq, int ret),
+
+	TP_ARGS(cmd, len, portid, seq, ret),
+
+	TP_STRUCT__entry(
+		__field(u8, cmd)
+		__field(int, len)
+		__field(u32, portid)
+		__field(u32, seq)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->len = len;
+		__entry->portid = portid;
+		__entry->seq = seq;
+		__entry->ret = ret;
+	),
+
+	TP_printk("cmd=%u len=%d portid=%u seq=%u ret=%d", __entry->cmd, __entry->len,
+		__entry->portid, __entry->seq, __entry->ret)
+);
+
+#endif /* _TEST_GENL_TRACE_H */
+
+// This part must be outside the protection.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE test_genl_trace
+#include <trace/define_trace.h>
@@ -1,10 +1,29 @@
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/netlink_diag.h>
+
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#include "test_netlink_schema.h"
+
 #define NETLINK_DEFAULT		30
 
 #define DEFAULT_GROUP   	1
@@ -17,9 +36,90 @@
 #define MAX_PAYLOAD 60000      /* maximum payload size*/
 #define MAX_NL_BUFSIZ  NLMSG_SPACE(MAX_PAYLOAD)
 
+#if PY_MAJOR_VERSION >= 3
+#define BYTES_FMT "y#"
+#else
+#define BYTES_FMT "s#"
+#endif
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK	270
+#endif
+
 #define MAX_FD 1024
 static uint32_t fd_portid[MAX_FD] = {0};
 
+#define NL_LAT_BUCKETS	32	// log2 buckets of the latency in ns
+
+// The counters of a socket, read by stats(). They are updated without a lock
+// (the GIL is released around the syscalls), so they are approximate if many
+// threads share a socket. The upcall latency is from the upcall in the kernel
+// to the delivery, for the service types whose upcalls carry a struct nl_stamp.
+struct nl_stats {
+	unsigned long long tx_msgs;
+	unsigned long long tx_bytes;
+	unsigned long long tx_syscalls;
+	unsigned long long rx_msgs;
+	unsigned long long rx_bytes;
+	unsigned long long rx_syscalls;
+	unsigned long long eagain;
+	unsigned long long enobufs;
+	unsigned long long errors;
+	unsigned long long discards;	// The messages of another service type.
+	unsigned long long cork_msgs;	// The corked messages, and the datagrams
+	unsigned long long cork_datagrams;	// which carried them.
+	unsigned long long cork_deadline;	// The datagrams sent by the deadline.
+	unsigned long long poll_hits;	// The busy polls which have got a datagram,
+	unsigned long long poll_misses;	// and which have fallen back to blocking.
+	unsigned long long poll_spin_ns;
+	unsigned long long upcall_latency[NL_LAT_BUCKETS];
+};
+static struct nl_stats fd_stats[MAX_FD];
+
+// Capture
+//
+// A capture file is a header followed by the records, each aligned to 8 bytes.
+// The file is grown and mapped by chunks, so recording a message is a memcpy.
+// The length of a record is written last and the rest of the file is zero,
+// so a reader stops at the first zero length even if the writer crashed.
+#define NL_CAP_MAGIC	"NLCAP\0\0\0"
+#define NL_CAP_VERSION	1
+#define NL_CAP_CHUNK	(4 << 20)
+#define NL_CAP_ALIGN(len)	(((len) + 7) & ~7)
+
+#define NL_CAP_RX	0
+#define NL_CAP_TX	1
+
+struct nl_cap_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;	// sizeof(struct nl_cap_record)
+	uint64_t time;		// CLOCK_REALTIME in ns, when the capture started
+};
+
+struct nl_cap_record {
+	uint32_t len;		// The size of the record, including the payload
+	uint8_t dir;		// NL_CAP_RX or NL_CAP_TX
+	uint8_t type;		// The service type
+	uint16_t flags;		// nlmsg_flags
+	uint64_t time;		// CLOCK_REALTIME in ns
+	uint32_t pid;		// The destination of a sent message, or the source of a received one
+	uint32_t group;		// The groups mask of the destination or the source
+	uint32_t seq;
+	uint32_t size;		// The size of the payload which follows
+};
+
+struct nl_capture {
+	int fd;
+	int error;
+	char *map;		// Map [map_off, map_off + NL_CAP_CHUNK) of the file.
+	off_t map_off;
+	off_t off;		// The end of the records.
+	off_t size;		// The size of the file.
+	unsigned long records;
+};
+static struct nl_capture *fd_capture[MAX_FD];
+
 
 static PyObject* None()
 {
@@ -28,6 +128,314 @@ static PyObject* None()
 }
 
 
+static void nl_stats_error(struct nl_stats *st, int err)
+{
+	if (err == EAGAIN || err == EWOULDBLOCK) {
+		st->eagain++;
+	} else if (err == ENOBUFS) {
+		st->enobufs++;
+	} else if (err != EINTR) {
+		st->errors++;
+	}
+}
+
+
+static void nl_stats_latency(unsigned long long *latency, long long ns)
+{
+	int b = 0;
+
+	while (ns > 1 && b < NL_LAT_BUCKETS - 1) {
+		ns >>= 1;
+		b++;
+	}
+	latency[b]++;
+}
+
+
+// Take the struct nl_stamp of an upcall with NL_F_TIMESTAMP off its service
+// data, `data` and `size` being those after the type byte, and feed the upcall
+// latency histogram of the socket. Return 1 if the message is stamped, 0 if
+// not, or -1 if it is shorter than its stamp.
+static int nl_msg_stamp(int fd, struct nlmsghdr *nlh, unsigned char **data, Py_ssize_t *size,
+		struct nl_stamp *stamp)
+{
+	struct timespec now;
+
+	if (!(nlh->nlmsg_flags & NL_F_TIMESTAMP)) {
+		return 0;
+	}
+	if (*size < (Py_ssize_t)sizeof(*stamp)) {
+		return -1;
+	}
+	memcpy(stamp, *data, sizeof(*stamp));
+	*data += sizeof(*stamp);
+	*size -= sizeof(*stamp);
+
+	// The kernel stamps with ktime_get(), which is CLOCK_MONOTONIC.
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	nl_stats_latency(fd_stats[fd].upcall_latency,
+			(long long)(now.tv_sec * 1000000000ULL + now.tv_nsec - stamp->ns));
+	return 1;
+}
+
+
+// recvfrom(), which also updates the counters of the socket.
+static int nl_recv_counted(int fd, void *buffer, size_t size, int flags, struct sockaddr_nl *from)
+{
+	struct nl_stats *st = &fd_stats[fd];
+	socklen_t addrlen = sizeof(*from);
+	int ret;
+
+	ret = recvfrom(fd, buffer, size, flags, (struct sockaddr *)from, from ? &addrlen : NULL);
+	st->rx_syscalls++;
+	if (ret < 0) {
+		nl_stats_error(st, errno);
+	}
+	return ret;
+}
+
+
+// Query the memory usage and the drops of a socket through NETLINK_SOCK_DIAG.
+// `meminfo` gets the SK_MEMINFO_* values, 0 for those an old kernel does not give.
+static int nl_diag_meminfo(int fd, __u32 *meminfo)
+{
+	struct {
+		struct nlmsghdr n;
+		struct netlink_diag_req r;
+	} req;
+	char buf[32768];
+	struct netlink_diag_msg *dm;
+	struct nlmsghdr *nlh;
+	struct nlattr *na;
+	struct stat st;
+	socklen_t optlen = sizeof(int);
+	size_t size;
+	int sd, protocol, len, alen, ret = -1;
+
+	if (fstat(fd, &st) < 0 || getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &optlen) < 0) {
+		return -1;
+	}
+
+	sd = socket(AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
+	if (sd < 0) {
+		return -1;
+	}
+
+	// The kernel dumps every socket of the protocol, so find ours by inode.
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = sizeof(req);
+	req.n.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.r.sdiag_family = AF_NETLINK;
+	req.r.sdiag_protocol = protocol;
+	req.r.ndiag_show = NDIAG_SHOW_MEMINFO;
+	if (send(sd, &req, sizeof(req), 0) < 0) {
+		goto out;
+	}
+
+	memset(meminfo, 0, SK_MEMINFO_VARS * sizeof(__u32));
+	for (;;) {
+		len = recv(sd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			goto out;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) {
+				goto out;
+			}
+			dm = NLMSG_DATA(nlh);
+			if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*dm)) || dm->ndiag_ino != st.st_ino) {
+				continue;
+			}
+			alen = nlh->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(sizeof(*dm)));
+			na = (struct nlattr *)((char *)dm + NLMSG_ALIGN(sizeof(*dm)));
+			while (alen >= (int)NLA_HDRLEN && na->nla_len >= NLA_HDRLEN && na->nla_len <= alen) {
+				if ((na->nla_type & NLA_TYPE_MASK) == NETLINK_DIAG_MEMINFO) {
+					size = na->nla_len - NLA_HDRLEN;
+					if (size > SK_MEMINFO_VARS * sizeof(__u32))
+						size = SK_MEMINFO_VARS * sizeof(__u32);
+					memcpy(meminfo, (char *)na + NLA_HDRLEN, size);
+					ret = 0;
+				}
+				alen -= NLA_ALIGN(na->nla_len);
+				na = (struct nlattr *)((char *)na + NLA_ALIGN(na->nla_len));
+			}
+		}
+	}
+
+out:
+	close(sd);
+	return ret;
+}
+
+
+static uint64_t nl_realtime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// Return the address of `len` bytes at the end of the records, growing and
+// remapping the file if needed.
+static char *nl_capture_reserve(struct nl_capture *cap, size_t len)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	off_t map_off;
+
+	if (cap->map && cap->off + (off_t)len <= cap->map_off + NL_CAP_CHUNK) {
+		return cap->map + (cap->off - cap->map_off);
+	}
+	if (len > NL_CAP_CHUNK - page) {
+		return NULL;
+	}
+
+	if (cap->map) {
+		munmap(cap->map, NL_CAP_CHUNK);
+		cap->map = NULL;
+	}
+
+	map_off = cap->off & ~((off_t)page - 1);
+	if (map_off + NL_CAP_CHUNK > cap->size) {
+		if (ftruncate(cap->fd, map_off + NL_CAP_CHUNK) < 0) {
+			return NULL;
+		}
+		cap->size = map_off + NL_CAP_CHUNK;
+	}
+
+	cap->map = mmap(NULL, NL_CAP_CHUNK, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, map_off);
+	if (cap->map == MAP_FAILED) {
+		cap->map = NULL;
+		return NULL;
+	}
+	cap->map_off = map_off;
+	return cap->map + (cap->off - map_off);
+}
+
+
+// Append a message to the capture of the socket, if it is capturing. Called
+// with the GIL held, which serializes the writers.
+static void nl_capture_msg(int fd, int dir, unsigned char type, uint16_t flags, uint32_t pid,
+		uint32_t group, uint32_t seq, const void *data, size_t size)
+{
+	struct nl_capture *cap = fd_capture[fd];
+	struct nl_cap_record *rec;
+	size_t len = sizeof(*rec) + size;
+
+	if (!cap || cap->error) {
+		return;
+	}
+
+	rec = (struct nl_cap_record *)nl_capture_reserve(cap, NL_CAP_ALIGN(len));
+	if (!rec) {
+		cap->error = errno ? errno : ENOSPC;
+		return;
+	}
+
+	rec->dir = dir;
+	rec->type = type;
+	rec->flags = flags;
+	rec->time = nl_realtime();
+	rec->pid = pid;
+	rec->group = group;
+	rec->seq = seq;
+	rec->size = size;
+	memcpy(rec + 1, data, size);
+	__sync_synchronize();
+	rec->len = len;
+
+	cap->off += NL_CAP_ALIGN(len);
+	cap->records++;
+}
+
+
+// Capture every service message in a datagram.
+static void nl_capture_datagram(int fd, int dir, const char *buf, int len, uint32_t pid, uint32_t group)
+{
+	struct nlmsghdr *nlh;
+	unsigned char *data;
+
+	if (!fd_capture[fd]) {
+		return;
+	}
+
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		if (NLMSG_PAYLOAD(nlh, 0) < 1) {
+			continue;
+		}
+		// The acks and the end of a dump don't start with a service type.
+		// The upcalls are NLMSG_DONE too, but without NLM_F_MULTI.
+		if (nlh->nlmsg_type == NLMSG_ERROR ||
+		    (nlh->nlmsg_type == NLMSG_DONE && (nlh->nlmsg_flags & NLM_F_MULTI))) {
+			continue;
+		}
+		data = (unsigned char *)NLMSG_DATA(nlh);
+		nl_capture_msg(fd, dir, *data, nlh->nlmsg_flags, pid, group, nlh->nlmsg_seq,
+				data + 1, NLMSG_PAYLOAD(nlh, 0) - 1);
+	}
+}
+
+
+static int nl_capture_start(int fd, const char *path)
+{
+	struct nl_capture *cap;
+	struct nl_cap_header *hdr;
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap) {
+		return -1;
+	}
+	cap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (cap->fd < 0) {
+		free(cap);
+		return -1;
+	}
+
+	hdr = (struct nl_cap_header *)nl_capture_reserve(cap, sizeof(*hdr));
+	if (!hdr) {
+		close(cap->fd);
+		free(cap);
+		return -1;
+	}
+	memcpy(hdr->magic, NL_CAP_MAGIC, sizeof(hdr->magic));
+	hdr->version = NL_CAP_VERSION;
+	hdr->record_size = sizeof(struct nl_cap_record);
+	hdr->time = nl_realtime();
+	cap->off = NL_CAP_ALIGN(sizeof(*hdr));
+
+	fd_capture[fd] = cap;
+	return 0;
+}
+
+
+// Stop the capture, and truncate the file to the records.
+// Return the number of records, or -1 if an error has stopped the capture.
+static long nl_capture_stop(int fd)
+{
+	struct nl_capture *cap = fd_capture[fd];
+	long ret;
+
+	if (!cap) {
+		return 0;
+	}
+	fd_capture[fd] = NULL;
+
+	if (cap->map) {
+		munmap(cap->map, NL_CAP_CHUNK);
+	}
+	if (ftruncate(cap->fd, cap->off) < 0 && !cap->error) {
+		cap->error = errno;
+	}
+	close(cap->fd);
+
+	ret = cap->error ? -1 : (long)cap->records;
+	free(cap);
+	return ret;
+}
+
+
 static int nl_create(uint32_t pid, uint32_t groups, uint32_t protocol)
 {
 	int fd = socket(PF_NETLINK, SOCK_RAW, protocol);
@@ -52,8 +460,10 @@ static int nl_create(uint32_t pid, uint32_t groups, uint32_t protocol)
 static int nl_send(int fd, void *buffer, size_t size, struct sockaddr_nl *addr, unsigned char type)
 {
 	char nl_tmp_buffer[MAX_NL_BUFSIZ];
+	struct nl_stats *st = &fd_stats[fd];
 	struct nlmsghdr *nlh;
 	unsigned char * tmp;
+	int ret;
 
 	if (size+1 > MAX_NL_BUFSIZ) {
 		return -1;
@@ -72,7 +482,15 @@ static int nl_send(int fd, void *buffer, size_t size, struct sockaddr_nl *addr,
 	//nlh->nlmsg_len = NLMSG_SPACE(size+1);
 	nlh->nlmsg_len = NLMSG_LENGTH(size + 1);
 
-	return sendto(fd, nlh, NLMSG_SPACE(size+1), 0, (struct sockaddr *)addr, sizeof(*addr));
+	ret = sendto(fd, nlh, NLMSG_SPACE(size+1), 0, (struct sockaddr *)addr, sizeof(*addr));
+	st->tx_syscalls++;
+	if (ret < 0) {
+		nl_stats_error(st, errno);
+	} else {
+		st->tx_msgs++;
+		st->tx_bytes += ret;
+	}
+	return ret;
 
 	// return sendto(fd, nlh, NLMSG_SPACE(size+1), 0,
 	// 		(struct sockaddr *)addr, sizeof(*addr));
@@ -90,119 +508,1811 @@ static int nl_send(int fd, void *buffer, size_t size, struct sockaddr_nl *addr,
 	// return sendmsg(sock_fd, &msg, 0);
 }
 
-//// ==================
-
-// create([pid=1, group=1, protocol=30])
-static PyObject* py_nl_create(PyObject *self, PyObject *args, PyObject *keywds)
+// Append a netlink service message to `buffer`, which is used to pack many
+// messages into one datagram.
+static int nl_put_msg(char *buffer, size_t bufsize, size_t *offset, int fd,
+		const void *data, size_t size, unsigned char type)
 {
-	int fd = -1;
-	unsigned long pid = DEFAULT_PORTID;	// 1
-	unsigned long group = DEFAULT_GROUP;	// 1
-	unsigned long protocol = NETLINK_DEFAULT;  // 30
-	static char *kwlist[] = {"pid", "group", "protocol", NULL};
+	struct nlmsghdr *nlh;
+	unsigned char *tmp;
 
-	if (!PyArg_ParseTupleAndKeywords(args, keywds, "|kkk", kwlist, &pid, &group, &protocol))
-		return Py_BuildValue("i", -1);
+	if (*offset + NLMSG_SPACE(size+1) > bufsize) {
+		return -1;
+	}
 
-	fd = nl_create((uint32_t)pid, (uint32_t)group, protocol);
-	if (fd < 0)
-		return Py_BuildValue("i", -2);
+	nlh = (struct nlmsghdr *)(buffer + *offset);
+	memset(nlh, 0, NLMSG_SPACE(size+1));
+	nlh->nlmsg_len = NLMSG_LENGTH(size + 1);
+	nlh->nlmsg_pid = fd_portid[fd];
 
-	if (fd >= MAX_FD) {
-		close(fd);
-		return Py_BuildValue("i", -3);
-	}
+	tmp = NLMSG_DATA(nlh);
+	*tmp = type;
+	memcpy(tmp + 1, data, size);
 
-	fd_portid[fd] = pid;
-	return Py_BuildValue("i", fd);
+	*offset += NLMSG_SPACE(size+1);
+	return 0;
 }
 
-// recv(fd [, type=0])
-static PyObject* py_nl_recv(PyObject *self, PyObject *args, PyObject *keywds)
-{
-	int fd;
-	int ret;
-	unsigned char type = DEFAULT_RECV_TYPE;
+// Cork
+//
+// While a socket is corked, send() appends the message to a staging datagram
+// instead of sending it. The datagram is sent when it reaches max_bytes or
+// max_msgs, when its first message has waited delay_us, when a message to
+// another destination comes, or on flush(). The deadline is kept by a thread
+// of the module, which sends the expired datagrams whatever the producer
+// does, so it only needs the socket and never takes the GIL.
+//
+// A sendto may block until the receiver drains its socket, so a thread never
+// waits for the lock of a cork while it holds the GIL, see nl_cork_lock().
+// The cork of a fd is kept once allocated, so that it is never freed under a
+// sender; uncork() only clears `active`.
+
+struct nl_cork {
+	pthread_mutex_t lock;
+	int active;
+	size_t max_bytes;
+	unsigned int max_msgs;
+	uint64_t delay;		// ns, 0 means no deadline.
+	uint64_t deadline;	// CLOCK_MONOTONIC ns of the flush, 0 if empty.
+	uint32_t pid;		// The destination of the staged messages.
+	uint32_t group;
+	unsigned int count;
+	size_t len;
 	char buf[MAX_NL_BUFSIZ];
-	PyObject *result = NULL;
-	unsigned char *data;
-	struct nlmsghdr *nlh;
+};
+static struct nl_cork *fd_cork[MAX_FD];
 
-	static char *kwlist[] = {"fd", "type", NULL};
+// Protect the allocation of the corks and the sleep of the flusher.
+static pthread_mutex_t nl_cork_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t nl_cork_cond;
+static int nl_cork_started = 0;
+static int nl_cork_pending = 0;		// A deadline has started since the last scan.
 
-	if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|b", kwlist, &fd, &type)) {
-		return None();
-		//return NULL;
+
+static uint64_t nl_monotonic(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Lock the cork with the GIL, which is released only if the cork is busy.
+static void nl_cork_lock(struct nl_cork *cork)
+{
+	if (pthread_mutex_trylock(&cork->lock) != 0) {
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&cork->lock);
+		Py_END_ALLOW_THREADS
 	}
+}
 
-	memset(buf, 0, MAX_NL_BUFSIZ);
-	ret = recvfrom(fd, buf, MAX_NL_BUFSIZ, 0, NULL, NULL);
+// Send the staged datagram, with the lock of the cork. Return the bytes sent,
+// 0 if nothing is staged, or -1; the messages are dropped if failed.
+static int nl_cork_flush(int fd, struct nl_cork *cork)
+{
+	struct nl_stats *st = &fd_stats[fd];
+	struct sockaddr_nl addr;
+	int ret;
+
+	if (!cork->count) {
+		return 0;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = cork->pid;
+	addr.nl_groups = cork->group;
+
+	ret = sendto(fd, cork->buf, cork->len, 0, (struct sockaddr *)&addr, sizeof(addr));
+	st->tx_syscalls++;
 	if (ret < 0) {
-		return None();
+		nl_stats_error(st, errno);
+		ret = -1;
+	} else {
+		st->tx_msgs += cork->count;
+		st->tx_bytes += ret;
+		st->cork_msgs += cork->count;
+		st->cork_datagrams++;
 	}
 
-	nlh = (struct nlmsghdr *)buf;
-	data = (unsigned char *)NLMSG_DATA(nlh);
+	cork->count = 0;
+	cork->len = 0;
+	cork->deadline = 0;
+	return ret;
+}
 
-	if (NLMSG_PAYLOAD(nlh, 0) <= 1) {
-		return None();
+// Whether staging a message of `size` bytes to (pid, group) sends a datagram.
+static int nl_cork_sends(struct nl_cork *cork, size_t size, uint32_t pid, uint32_t group)
+{
+	size_t len = cork->len + NLMSG_SPACE(size+1);
+
+	if (cork->count && (cork->pid != pid || cork->group != group || len > sizeof(cork->buf))) {
+		return 1;
 	}
+	return len >= cork->max_bytes || cork->count + 1 >= cork->max_msgs;
+}
 
-	if (*data != type)  {
-		return None();
+// Stage a message, with the lock of the cork. Return the size of the message
+// in the datagram, or -1 if it is too large or a flush has failed; the message
+// is not staged if the flush of the previous ones has failed, and is dropped
+// with the others if the flush of its own datagram has. *wake is set if the
+// message has started a deadline.
+static int nl_cork_put(int fd, struct nl_cork *cork, const void *data, size_t size,
+		unsigned char type, uint32_t pid, uint32_t group, int *wake)
+{
+	*wake = 0;
+	if (cork->count && (cork->pid != pid || cork->group != group
+				|| cork->len + NLMSG_SPACE(size+1) > sizeof(cork->buf))) {
+		if (nl_cork_flush(fd, cork) < 0) {
+			return -1;
+		}
 	}
 
-	result = Py_BuildValue("(s#kHHkk)", (char *)(data+1), (unsigned long)NLMSG_PAYLOAD(nlh, 0)-1,
-			(unsigned long)NLMSG_PAYLOAD(nlh, 0)-1, (unsigned short)(nlh->nlmsg_type),
-			(unsigned short)(nlh->nlmsg_flags), (unsigned long)(nlh->nlmsg_seq),
-			(unsigned long)(nlh->nlmsg_pid));
+	if (nl_put_msg(cork->buf, sizeof(cork->buf), &cork->len, fd, data, size, type) < 0) {
+		return -1;
+	}
+	if (cork->count++ == 0) {
+		cork->pid = pid;
+		cork->group = group;
+		if (cork->delay) {
+			cork->deadline = nl_monotonic() + cork->delay;
+			*wake = 1;
+		}
+	}
 
-	if (result)
-		return result;
-	return None();
+	if (cork->len >= cork->max_bytes || cork->count >= cork->max_msgs) {
+		*wake = 0;
+		if (nl_cork_flush(fd, cork) < 0) {
+			return -1;
+		}
+	}
+	return (int)NLMSG_SPACE(size+1);
 }
 
-// send(fd, data, size [, pid=0, group=0, type=0])
-static PyObject* py_nl_send(PyObject *self, PyObject *args, PyObject *keywds)
+// The thread which sends the datagrams whose deadline has expired.
+static void *nl_cork_flusher(void *arg)
 {
+	struct nl_cork *cork;
+	struct timespec ts;
+	uint64_t now, next;
 	int fd;
-	int ret;
-	char *data = NULL;
-	unsigned long size;
-	int _size;
-	unsigned long pid = DEFAULT_DEST_PORTID;
-	unsigned long group = DEFAULT_DEST_GROUP;
-	unsigned char type = DEFAULT_DEST_TYPE;
-	struct sockaddr_nl addr;
-	static char *kwlist[] = {"fd", "data", "size", "pid", "group", "type", NULL};
 
-	if (!PyArg_ParseTupleAndKeywords(args, keywds, "iz#k|kkb", kwlist, &fd, &data, &_size,  &size, &pid, &group, &type)) {
-		return Py_BuildValue("i", -2);
-		//return NULL;    // If return NULL, raise a Exception
+	// The default slack of 50us would be longer than the deadlines.
+	prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+
+	for (;;) {
+		now = nl_monotonic();
+		next = now + 1000000000ULL;
+		for (fd = 0; fd < MAX_FD; fd++) {
+			cork = __atomic_load_n(&fd_cork[fd], __ATOMIC_ACQUIRE);
+			if (!cork || !cork->deadline) {
+				continue;
+			}
+			pthread_mutex_lock(&cork->lock);
+			if (cork->deadline && cork->deadline <= now) {
+				if (nl_cork_flush(fd, cork) > 0) {
+					fd_stats[fd].cork_deadline++;
+				}
+			} else if (cork->deadline && cork->deadline < next) {
+				next = cork->deadline;
+			}
+			pthread_mutex_unlock(&cork->lock);
+		}
+
+		ts.tv_sec = next / 1000000000ULL;
+		ts.tv_nsec = next % 1000000000ULL;
+		pthread_mutex_lock(&nl_cork_mutex);
+		if (!nl_cork_pending) {
+			pthread_cond_timedwait(&nl_cork_cond, &nl_cork_mutex, &ts);
+		}
+		nl_cork_pending = 0;
+		pthread_mutex_unlock(&nl_cork_mutex);
 	}
+	return NULL;
+}
 
-	if (size != _size) {
-		return Py_BuildValue("i", -2);
+// Wake up the flusher for a new deadline.
+static void nl_cork_wake(void)
+{
+	pthread_mutex_lock(&nl_cork_mutex);
+	nl_cork_pending = 1;
+	pthread_cond_signal(&nl_cork_cond);
+	pthread_mutex_unlock(&nl_cork_mutex);
+}
+
+// Return the cork of the fd, allocated and with the flusher started if needed.
+static struct nl_cork *nl_cork_get(int fd)
+{
+	struct nl_cork *cork;
+	pthread_condattr_t attr;
+	pthread_t thread;
+
+	pthread_mutex_lock(&nl_cork_mutex);
+	if (!nl_cork_started) {
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&nl_cork_cond, &attr);
+		pthread_condattr_destroy(&attr);
+		if (pthread_create(&thread, NULL, nl_cork_flusher, NULL) != 0) {
+			pthread_cond_destroy(&nl_cork_cond);
+			pthread_mutex_unlock(&nl_cork_mutex);
+			return NULL;
+		}
+		pthread_detach(thread);
+		nl_cork_started = 1;
 	}
 
-	memset(&addr, 0, sizeof(addr));
-	addr.nl_family = AF_NETLINK;
-	addr.nl_pid = pid;
-	addr.nl_groups = group;
+	cork = fd_cork[fd];
+	if (!cork) {
+		cork = calloc(1, sizeof(*cork));
+		if (cork) {
+			pthread_mutex_init(&cork->lock, NULL);
+			__atomic_store_n(&fd_cork[fd], cork, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&nl_cork_mutex);
+	return cork;
+}
 
-	ret = nl_send(fd, data, (size_t)size, &addr, type);
-	if (ret < 0) {
-		ret = -1;
+// Send what is staged and stop corking, with the GIL. Return as nl_cork_flush.
+static int nl_cork_stop(int fd)
+{
+	struct nl_cork *cork = fd_cork[fd];
+	int ret;
+
+	if (!cork || !cork->active) {
+		return 0;
 	}
-	return Py_BuildValue("i", ret);
+
+	nl_cork_lock(cork);
+	cork->active = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = nl_cork_flush(fd, cork);
+	pthread_mutex_unlock(&cork->lock);
+	Py_END_ALLOW_THREADS
+	return ret;
 }
 
-// close(fd)
-static PyObject* py_nl_close(PyObject *self, PyObject *args)
+// Busy poll
+//
+// In busy-poll mode, recv() and recv_batch() spin on poll() with no timeout
+// for up to the budget before blocking in recvfrom(), which saves the sleep
+// and the wakeup of the thread when a datagram comes within the budget. The
+// GIL is released while spinning. If adaptive, the budget follows the EWMA of
+// the intervals between the datagrams: twice the expected interval, at most
+// the given budget, and no spin at all if the datagrams come further apart
+// than that, since spinning would only burn the CPU.
+
+struct nl_poll {
+	uint64_t max_budget;	// ns, 0 means disabled.
+	uint64_t budget;	// ns of the next spin.
+	int adaptive;
+	uint64_t ewma;		// ns between two datagrams.
+	uint64_t last;		// CLOCK_MONOTONIC ns of the last datagram.
+};
+static struct nl_poll fd_poll[MAX_FD];
+
+#define NL_POLL_MIN_BUDGET	1000	// ns
+#define NL_POLL_EWMA_SHIFT	3	// The weight of a new interval is 1/8.
+
+
+static void nl_poll_update(struct nl_poll *p, uint64_t now)
 {
-	int fd;
-	if (!PyArg_ParseTuple(args, "i", &fd)) {
-		return None();
+	uint64_t interval;
+
+	if (p->last && now > p->last) {
+		interval = now - p->last;
+		if (p->ewma) {
+			p->ewma = p->ewma - (p->ewma >> NL_POLL_EWMA_SHIFT) + (interval >> NL_POLL_EWMA_SHIFT);
+		} else {
+			p->ewma = interval;
+		}
+
+		if (p->adaptive) {
+			if (p->ewma > p->max_budget) {
+				p->budget = 0;
+			} else if (p->ewma * 2 > p->max_budget) {
+				p->budget = p->max_budget;
+			} else {
+				p->budget = p->ewma * 2 > NL_POLL_MIN_BUDGET ? p->ewma * 2 : NL_POLL_MIN_BUDGET;
+			}
+		}
+	}
+	p->last = now;
+}
+
+// nl_recv_counted() without flags, which spins first if the socket is in busy-poll
+// mode. It must be called without the GIL.
+static int nl_recv_poll(int fd, void *buffer, size_t size, struct sockaddr_nl *from)
+{
+	struct nl_poll *p = &fd_poll[fd];
+	struct nl_stats *st = &fd_stats[fd];
+	struct pollfd pfd;
+	uint64_t start, now, end;
+	int ret = 0;
+
+	if (!p->max_budget) {
+		return nl_recv_counted(fd, buffer, size, 0, from);
+	}
+
+	if (p->budget) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		start = now = nl_monotonic();
+		end = start + p->budget;
+		while ((ret = poll(&pfd, 1, 0)) == 0 && now < end) {
+			now = nl_monotonic();
+		}
+		st->poll_spin_ns += nl_monotonic() - start;
+		if (ret > 0) {
+			st->poll_hits++;
+		} else {
+			st->poll_misses++;
+		}
+	}
+
+	ret = nl_recv_counted(fd, buffer, size, 0, from);
+	if (ret >= 0) {
+		nl_poll_update(p, nl_monotonic());
+	}
+	return ret;
+}
+
+// Relay
+//
+// One process (the producer) receives from a netlink socket and writes the
+// messages into a ring in shared memory, which many local processes (the
+// consumers) read, so the kernel delivers every message once whatever the
+// number of consumers. The ring has a power of two of fixed-size slots. The
+// message `n` goes into the slot `n % nslots`, whose `seq` is 0 while it is
+// written and `n + 1` once it is complete. A consumer only keeps its own
+// cursor: it copies a slot, then checks that `seq` has not changed, so it never
+// blocks the producer; a consumer which falls more than nslots behind skips the
+// overwritten messages and counts them as overruns.
+#define NL_RELAY_MAGIC		"NLRELAY\0"
+#define NL_RELAY_VERSION	1
+#define NL_RELAY_MAX		64
+
+struct nl_relay_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_size;	// The size of a slot, its header included
+	uint64_t nslots;
+	uint64_t dropped;	// The messages larger than a slot
+	char pad1[32];
+	// Written by the producer for every message, in its own cache line.
+	uint64_t head;		// The number of the messages written
+	uint32_t futex;		// Bumped for every datagram, to wake up the consumers
+	uint32_t waiters;	// The consumers waiting on futex
+	char pad2[48];
+};
+
+struct nl_relay_slot {
+	uint64_t seq;
+	uint32_t size;		// The size of the payload which follows
+	uint16_t nlmsg_type;
+	uint16_t flags;
+	uint32_t msg_seq;
+	uint32_t pid;
+	uint8_t type;		// The service type
+	uint8_t pad[7];
+};
+
+struct nl_relay {
+	struct nl_relay_header *hdr;
+	size_t map_size;
+	int producer;
+	char name[NAME_MAX];
+	// The state of a consumer, private to the process.
+	uint64_t cursor;
+	uint64_t reads;
+	uint64_t overruns;
+};
+static struct nl_relay *relays[NL_RELAY_MAX];
+
+
+static inline struct nl_relay_slot *nl_relay_slot(struct nl_relay_header *hdr, uint64_t n)
+{
+	return (struct nl_relay_slot *)((char *)(hdr + 1) + (n & (hdr->nslots - 1)) * hdr->slot_size);
+}
+
+
+static struct nl_relay *nl_relay_get(int h)
+{
+	return h >= 0 && h < NL_RELAY_MAX ? relays[h] : NULL;
+}
+
+
+// Create (producer) or attach to (consumer) the ring `name`.
+static struct nl_relay *nl_relay_map(const char *name, int producer, uint64_t nslots, uint32_t slot_size)
+{
+	struct nl_relay *relay;
+	struct nl_relay_header *hdr;
+	struct stat st;
+	uint64_t magic;
+	size_t size;
+	int fd;
+
+	memcpy(&magic, NL_RELAY_MAGIC, sizeof(magic));
+	if (producer) {
+		// The consumers of a previous ring keep it until they detach.
+		shm_unlink(name);
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (fd < 0) {
+			return NULL;
+		}
+		size = sizeof(*hdr) + nslots * slot_size;
+		if (ftruncate(fd, size) < 0) {
+			close(fd);
+			shm_unlink(name);
+			return NULL;
+		}
+	} else {
+		fd = shm_open(name, O_RDWR, 0);
+		if (fd < 0) {
+			return NULL;
+		}
+		if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr)) {
+			close(fd);
+			return NULL;
+		}
+		size = st.st_size;
+	}
+
+	hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		if (producer)
+			shm_unlink(name);
+		return NULL;
+	}
+
+	// A consumer may attach while the producer fills the header, so the magic
+	// is published last, and the header is only trusted once it is seen.
+	if (producer) {
+		hdr->version = NL_RELAY_VERSION;
+		hdr->slot_size = slot_size;
+		hdr->nslots = nslots;
+		__atomic_store_n((uint64_t *)hdr->magic, magic, __ATOMIC_RELEASE);
+	} else if (__atomic_load_n((uint64_t *)hdr->magic, __ATOMIC_ACQUIRE) != magic
+			|| hdr->version != NL_RELAY_VERSION
+			|| !hdr->nslots || (hdr->nslots & (hdr->nslots - 1))
+			|| hdr->slot_size <= sizeof(struct nl_relay_slot)
+			|| hdr->nslots > (size - sizeof(*hdr)) / hdr->slot_size) {
+		munmap(hdr, size);
+		return NULL;
+	}
+
+	relay = calloc(1, sizeof(*relay));
+	if (!relay) {
+		munmap(hdr, size);
+		if (producer)
+			shm_unlink(name);
+		return NULL;
+	}
+	relay->hdr = hdr;
+	relay->map_size = size;
+	relay->producer = producer;
+	snprintf(relay->name, sizeof(relay->name), "%s", name);
+	return relay;
+}
+
+
+static void nl_relay_unmap(struct nl_relay *relay)
+{
+	munmap(relay->hdr, relay->map_size);
+	if (relay->producer) {
+		shm_unlink(relay->name);
+	}
+	free(relay);
+}
+
+
+// Write a service message into the ring, whose service data is `data`.
+// Only one producer writes a ring.
+static void nl_relay_write(struct nl_relay_header *hdr, struct nlmsghdr *nlh, unsigned char *data, size_t size)
+{
+	uint64_t n = hdr->head;
+	struct nl_relay_slot *slot = nl_relay_slot(hdr, n);
+
+	if (sizeof(*slot) + size > hdr->slot_size) {
+		hdr->dropped++;
+		return;
+	}
+
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->size = size;
+	slot->nlmsg_type = nlh->nlmsg_type;
+	slot->flags = nlh->nlmsg_flags;
+	slot->msg_seq = nlh->nlmsg_seq;
+	slot->pid = nlh->nlmsg_pid;
+	slot->type = *(unsigned char *)NLMSG_DATA(nlh);
+	memcpy(slot + 1, data, size);
+	__atomic_store_n(&slot->seq, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->head, n + 1, __ATOMIC_RELEASE);
+}
+
+
+// Receive a datagram from `fd` and write its service messages into the ring,
+// then wake up the waiting consumers.
+// Return the number of the messages, or -1 if recv failed.
+static int nl_relay_pump(struct nl_relay *relay, int fd, int flags)
+{
+	struct nl_relay_header *hdr = relay->hdr;
+	char buf[MAX_NL_BUFSIZ];
+	struct nlmsghdr *nlh;
+	struct nl_stamp stamp;
+	unsigned char *data;
+	Py_ssize_t size;
+	int len, n = 0;
+
+	len = nl_recv_counted(fd, buf, sizeof(buf), flags, NULL);
+	if (len < 0) {
+		return -1;
+	}
+
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		if (NLMSG_PAYLOAD(nlh, 0) < 1) {
+			continue;
+		}
+		// Without the type byte, and the stamp which is not kept in the ring.
+		data = (unsigned char *)NLMSG_DATA(nlh) + 1;
+		size = (Py_ssize_t)NLMSG_PAYLOAD(nlh, 0) - 1;
+		if (nl_msg_stamp(fd, nlh, &data, &size, &stamp) < 0) {
+			fd_stats[fd].discards++;
+			continue;
+		}
+		nl_relay_write(hdr, nlh, data, (size_t)size);
+		fd_stats[fd].rx_msgs++;
+		fd_stats[fd].rx_bytes += nlh->nlmsg_len;
+		n++;
+	}
+
+	// Both are SEQ_CST, as the increment of `waiters` by the consumers, so the
+	// load can't be ordered before the store and miss a consumer going to sleep.
+	__atomic_add_fetch(&hdr->futex, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hdr->waiters, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &hdr->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+	return n;
+}
+
+
+//// ================== The records of test_netlink_schema.h
+
+struct nl_schema_field {
+	const char *name;
+	const char *code;	// The type code of the array module
+	size_t size;
+	size_t offset;
+};
+
+struct nl_schema {
+	const char *name;
+	int type;
+	size_t size;		// The size of a record
+	struct nl_schema_field fields[NL_SCHEMA_MAX_FIELDS];
+	int nfields;		// Filled by nl_schema_find(), with the offsets.
+};
+
+#define NL_SCHEMA_FIELD(name, type, code)	{#name, code, sizeof(type), 0},
+#define NL_SCHEMA_DESC(schema, stype, FIELDS) \
+	{#schema, stype, sizeof(struct nl_rec_##schema), {FIELDS(NL_SCHEMA_FIELD)}, 0},
+
+static struct nl_schema nl_schemas[] = {
+	TEST_NETLINK_SCHEMAS(NL_SCHEMA_DESC)
+};
+#define NL_SCHEMA_NUM	(sizeof(nl_schemas) / sizeof(nl_schemas[0]))
+
+
+static void nl_schema_layout(void)
+{
+	static int done = 0;
+	struct nl_schema *s;
+	size_t i, offset;
+	int j;
+
+	if (done) {
+		return;
+	}
+	for (i = 0; i < NL_SCHEMA_NUM; i++) {
+		s = &nl_schemas[i];
+		offset = 0;
+		for (j = 0; j < NL_SCHEMA_MAX_FIELDS && s->fields[j].name; j++) {
+			s->fields[j].offset = offset;	// The records are packed.
+			offset += s->fields[j].size;
+		}
+		s->nfields = j;
+	}
+	done = 1;
+}
+
+static struct nl_schema* nl_schema_find(int type)
+{
+	size_t i;
+
+	nl_schema_layout();
+	for (i = 0; i < NL_SCHEMA_NUM; i++) {
+		if (nl_schemas[i].type == type) {
+			return &nl_schemas[i];
+		}
+	}
+	return NULL;
+}
+
+static PyObject* nl_schema_value(const struct nl_schema_field *f, const char *p)
+{
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+	float fv;
+	double dv;
+
+	switch (f->code[0]) {
+	case 'f':
+		memcpy(&fv, p, sizeof(fv));
+		return PyFloat_FromDouble(fv);
+	case 'd':
+		memcpy(&dv, p, sizeof(dv));
+		return PyFloat_FromDouble(dv);
+	}
+
+	// The lower case codes are signed.
+	switch (f->size) {
+	case 1:
+		memcpy(&u8, p, 1);
+		return f->code[0] == 'b' ? PyLong_FromLong((int8_t)u8) : PyLong_FromLong(u8);
+	case 2:
+		memcpy(&u16, p, 2);
+		return f->code[0] == 'h' ? PyLong_FromLong((int16_t)u16) : PyLong_FromLong(u16);
+	case 4:
+		memcpy(&u32, p, 4);
+		return f->code[0] == 'i' ? PyLong_FromLong((int32_t)u32) : PyLong_FromUnsignedLong(u32);
+	default:
+		memcpy(&u64, p, 8);
+		return f->code[0] == 'q' ? PyLong_FromLongLong((int64_t)u64) : PyLong_FromUnsignedLongLong(u64);
+	}
+}
+
+// Get the buffers of `data`, which is a bytes-like object, or a sequence of
+// them or of the tuples of recv() and recv_batch(). Return the number of
+// buffers, which are released by nl_schema_release(), or -1 with an exception.
+static Py_ssize_t nl_schema_buffers(PyObject *data, size_t size, Py_buffer **views)
+{
+	PyObject *seq, *item;
+	Py_ssize_t i, n;
+	Py_buffer *v;
+
+	*views = NULL;
+	// A tuple of recv(): (data, size, ...)
+	if (PyTuple_Check(data) && PyTuple_GET_SIZE(data) > 1 && PyObject_CheckBuffer(PyTuple_GET_ITEM(data, 0))
+			&& !PyObject_CheckBuffer(PyTuple_GET_ITEM(data, 1))) {
+		data = PyTuple_GET_ITEM(data, 0);
+	}
+	if (PyObject_CheckBuffer(data)) {
+		v = PyMem_Malloc(sizeof(*v));
+		if (!v) {
+			PyErr_NoMemory();
+			return -1;
+		}
+		if (PyObject_GetBuffer(data, v, PyBUF_SIMPLE) < 0) {
+			PyMem_Free(v);
+			return -1;
+		}
+		n = 1;
+	} else {
+		seq = PySequence_Fast(data, "the data must be bytes or a sequence of bytes");
+		if (!seq) {
+			return -1;
+		}
+		n = PySequence_Fast_GET_SIZE(seq);
+		v = PyMem_Malloc(sizeof(*v) * (n ? n : 1));
+		if (!v) {
+			Py_DECREF(seq);
+			PyErr_NoMemory();
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			item = PySequence_Fast_GET_ITEM(seq, i);
+			if (PyTuple_Check(item) && PyTuple_GET_SIZE(item) > 0) {
+				item = PyTuple_GET_ITEM(item, 0);
+			}
+			if (PyObject_GetBuffer(item, &v[i], PyBUF_SIMPLE) < 0) {
+				while (i-- > 0) {
+					PyBuffer_Release(&v[i]);
+				}
+				PyMem_Free(v);
+				Py_DECREF(seq);
+				return -1;
+			}
+		}
+		Py_DECREF(seq);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (v[i].len % size) {
+			PyErr_Format(PyExc_ValueError, "%zd bytes are not a multiple of the record size %zu",
+					v[i].len, size);
+			while (n-- > 0) {
+				PyBuffer_Release(&v[n]);
+			}
+			PyMem_Free(v);
+			return -1;
+		}
+	}
+	*views = v;
+	return n;
+}
+
+static void nl_schema_release(Py_buffer *views, Py_ssize_t n)
+{
+	while (n-- > 0) {
+		PyBuffer_Release(&views[n]);
+	}
+	PyMem_Free(views);
+}
+
+static PyObject* nl_schema_tuples(struct nl_schema *s, Py_buffer *views, Py_ssize_t n, Py_ssize_t count)
+{
+	PyObject *result, *rec, *value;
+	Py_ssize_t i, k = 0;
+	const char *p, *end;
+	int j;
+
+	result = PyList_New(count);
+	if (!result) {
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		p = views[i].buf;
+		end = p + views[i].len;
+		for (; p < end; p += s->size) {
+			rec = PyTuple_New(s->nfields);
+			if (!rec) {
+				Py_DECREF(result);
+				return NULL;
+			}
+			PyList_SET_ITEM(result, k++, rec);
+			for (j = 0; j < s->nfields; j++) {
+				value = nl_schema_value(&s->fields[j], p + s->fields[j].offset);
+				if (!value) {
+					Py_DECREF(result);
+					return NULL;
+				}
+				PyTuple_SET_ITEM(rec, j, value);
+			}
+		}
+	}
+	return result;
+}
+
+// Gather every field into a bytes, and make an array.array of it.
+static PyObject* nl_schema_columns(struct nl_schema *s, Py_buffer *views, Py_ssize_t n, Py_ssize_t count)
+{
+	static PyObject *array = NULL;
+	PyObject *result, *column, *values;
+	struct nl_schema_field *f;
+	Py_ssize_t i;
+	const char *p, *end;
+	char *out;
+	int j;
+
+	if (!array) {
+		array = PyImport_ImportModule("array");
+		if (!array) {
+			return NULL;
+		}
+	}
+
+	result = PyDict_New();
+	if (!result) {
+		return NULL;
+	}
+	for (j = 0; j < s->nfields; j++) {
+		f = &s->fields[j];
+		values = PyBytes_FromStringAndSize(NULL, count * f->size);
+		if (!values) {
+			Py_DECREF(result);
+			return NULL;
+		}
+		out = PyBytes_AS_STRING(values);
+		for (i = 0; i < n; i++) {
+			p = views[i].buf;
+			end = p + views[i].len;
+			for (; p < end; p += s->size, out += f->size) {
+				memcpy(out, p + f->offset, f->size);
+			}
+		}
+
+		column = PyObject_CallMethod(array, "array", "sO", f->code, values);
+		Py_DECREF(values);
+		if (!column || PyDict_SetItemString(result, f->name, column) < 0) {
+			Py_XDECREF(column);
+			Py_DECREF(result);
+			return NULL;
+		}
+		Py_DECREF(column);
+	}
+	return result;
+}
+
+//// ==================
+
+// create([pid=1, group=1, protocol=30])
+static PyObject* py_nl_create(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int fd = -1;
+	unsigned long pid = DEFAULT_PORTID;	// 1
+	unsigned long group = DEFAULT_GROUP;	// 1
+	unsigned long protocol = NETLINK_DEFAULT;  // 30
+	static char *kwlist[] = {"pid", "group", "protocol", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "|kkk", kwlist, &pid, &group, &protocol))
+		return Py_BuildValue("i", -1);
+
+	fd = nl_create((uint32_t)pid, (uint32_t)group, protocol);
+	if (fd < 0)
+		return Py_BuildValue("i", -2);
+
+	if (fd >= MAX_FD) {
+		close(fd);
+		return Py_BuildValue("i", -3);
+	}
+
+	fd_portid[fd] = pid;
+	memset(&fd_stats[fd], 0, sizeof(fd_stats[fd]));
+	memset(&fd_poll[fd], 0, sizeof(fd_poll[fd]));
+	return Py_BuildValue("i", fd);
+}
+
+// Build (data, size, type, flags, seq, pid) of a received message, and with
+// `timestamps` (..., cpu, ns) of its stamp, both None if it is not stamped.
+static PyObject* nl_msg_tuple(struct nlmsghdr *nlh, unsigned char *data, Py_ssize_t size,
+		struct nl_stamp *stamp, int stamped, int timestamps)
+{
+	if (!timestamps) {
+		return Py_BuildValue("(" BYTES_FMT "kHHkk)", (char *)data, size,
+				(unsigned long)size, (unsigned short)(nlh->nlmsg_type),
+				(unsigned short)(nlh->nlmsg_flags), (unsigned long)(nlh->nlmsg_seq),
+				(unsigned long)(nlh->nlmsg_pid));
+	}
+	if (!stamped) {
+		return Py_BuildValue("(" BYTES_FMT "kHHkkOO)", (char *)data, size,
+				(unsigned long)size, (unsigned short)(nlh->nlmsg_type),
+				(unsigned short)(nlh->nlmsg_flags), (unsigned long)(nlh->nlmsg_seq),
+				(unsigned long)(nlh->nlmsg_pid), Py_None, Py_None);
+	}
+	return Py_BuildValue("(" BYTES_FMT "kHHkkIK)", (char *)data, size,
+			(unsigned long)size, (unsigned short)(nlh->nlmsg_type),
+			(unsigned short)(nlh->nlmsg_flags), (unsigned long)(nlh->nlmsg_seq),
+			(unsigned long)(nlh->nlmsg_pid), (unsigned int)stamp->cpu,
+			(unsigned long long)stamp->ns);
+}
+
+// recv(fd [, type=0, timestamps=False])
+// The stamp of an upcall is taken off its data, and with `timestamps` returned
+// as the cpu and the ns (CLOCK_MONOTONIC) of the upcall, see nl_msg_tuple.
+static PyObject* py_nl_recv(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int fd;
+	int ret;
+	unsigned char type = DEFAULT_RECV_TYPE;
+	int timestamps = 0;
+	char buf[MAX_NL_BUFSIZ];
+	PyObject *result = NULL;
+	unsigned char *data;
+	struct nlmsghdr *nlh;
+	struct sockaddr_nl from;
+	struct nl_stamp stamp;
+	Py_ssize_t size;
+	int stamped;
+
+	static char *kwlist[] = {"fd", "type", "timestamps", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|bi", kwlist, &fd, &type, &timestamps)) {
+		return None();
+		//return NULL;
+	}
+	if (fd < 0 || fd >= MAX_FD) {
+		return None();
+	}
+
+	memset(buf, 0, MAX_NL_BUFSIZ);
+	memset(&from, 0, sizeof(from));
+	Py_BEGIN_ALLOW_THREADS
+	ret = nl_recv_poll(fd, buf, MAX_NL_BUFSIZ, &from);
+	Py_END_ALLOW_THREADS
+	if (ret < 0) {
+		return None();
+	}
+	nl_capture_datagram(fd, NL_CAP_RX, buf, ret, from.nl_pid, from.nl_groups);
+
+	nlh = (struct nlmsghdr *)buf;
+	data = (unsigned char *)NLMSG_DATA(nlh);
+
+	if (NLMSG_PAYLOAD(nlh, 0) <= 1) {
+		return None();
+	}
+
+	if (*data != type)  {
+		fd_stats[fd].discards++;
+		return None();
+	}
+	data++;
+	size = (Py_ssize_t)NLMSG_PAYLOAD(nlh, 0) - 1;
+	stamped = nl_msg_stamp(fd, nlh, &data, &size, &stamp);
+	if (stamped < 0) {
+		fd_stats[fd].discards++;
+		return None();
+	}
+	fd_stats[fd].rx_msgs++;
+	fd_stats[fd].rx_bytes += nlh->nlmsg_len;
+
+	result = nl_msg_tuple(nlh, data, size, &stamp, stamped, timestamps);
+
+	if (result)
+		return result;
+	return None();
+}
+
+// send(fd, data, size [, pid=0, group=0, type=0])
+// If the socket is corked, stage the message, see cork().
+static PyObject* py_nl_send(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int fd;
+	int ret;
+	char *data = NULL;
+	unsigned long size;
+	Py_ssize_t _size;
+	unsigned long pid = DEFAULT_DEST_PORTID;
+	unsigned long group = DEFAULT_DEST_GROUP;
+	unsigned char type = DEFAULT_DEST_TYPE;
+	struct sockaddr_nl addr;
+	struct nl_cork *cork;
+	int wake;
+	static char *kwlist[] = {"fd", "data", "size", "pid", "group", "type", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "iz#k|kkb", kwlist, &fd, &data, &_size,  &size, &pid, &group, &type)) {
+		return Py_BuildValue("i", -2);
+		//return NULL;    // If return NULL, raise a Exception
+	}
+
+	if (size != _size || fd < 0 || fd >= MAX_FD) {
+		return Py_BuildValue("i", -2);
+	}
+
+	cork = fd_cork[fd];
+	if (cork && cork->active) {
+		// Only the flushes release the GIL, as they hold the lock of the cork.
+		nl_cork_lock(cork);
+		if (cork->active) {
+			if (nl_cork_sends(cork, (size_t)size, (uint32_t)pid, (uint32_t)group)) {
+				Py_BEGIN_ALLOW_THREADS
+				ret = nl_cork_put(fd, cork, data, (size_t)size, type, (uint32_t)pid, (uint32_t)group, &wake);
+				pthread_mutex_unlock(&cork->lock);
+				Py_END_ALLOW_THREADS
+			} else {
+				ret = nl_cork_put(fd, cork, data, (size_t)size, type, (uint32_t)pid, (uint32_t)group, &wake);
+				pthread_mutex_unlock(&cork->lock);
+			}
+			if (wake) {
+				nl_cork_wake();
+			}
+			if (ret >= 0) {
+				nl_capture_msg(fd, NL_CAP_TX, type, 0, pid, group, 0, data, (size_t)size);
+			}
+			return Py_BuildValue("i", ret);
+		}
+		pthread_mutex_unlock(&cork->lock);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = pid;
+	addr.nl_groups = group;
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = nl_send(fd, data, (size_t)size, &addr, type);
+	Py_END_ALLOW_THREADS
+	if (ret < 0) {
+		ret = -1;
+	} else {
+		nl_capture_msg(fd, NL_CAP_TX, type, 0, pid, group, 0, data, (size_t)size);
+	}
+	return Py_BuildValue("i", ret);
+}
+
+// send_batch(fd, msgs [, pid=0, group=0, type=0])
+// Send all the messages in one datagram. Return the byte number sent in fact.
+// If the socket is corked, the staged messages are sent before.
+static PyObject* py_nl_send_batch(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int fd;
+	int ret;
+	PyObject *msgs, *seq;
+	Py_ssize_t i, n;
+	Py_buffer view;
+	size_t offset = 0;
+	char buf[MAX_NL_BUFSIZ];
+	unsigned long pid = DEFAULT_DEST_PORTID;
+	unsigned long group = DEFAULT_DEST_GROUP;
+	unsigned char type = DEFAULT_DEST_TYPE;
+	struct sockaddr_nl addr;
+	struct nl_cork *cork;
+	static char *kwlist[] = {"fd", "msgs", "pid", "group", "type", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "iO|kkb", kwlist, &fd, &msgs, &pid, &group, &type)) {
+		return Py_BuildValue("i", -2);
+	}
+	if (fd < 0 || fd >= MAX_FD) {
+		return Py_BuildValue("i", -2);
+	}
+
+	seq = PySequence_Fast(msgs, "msgs must be a sequence");
+	if (!seq) {
+		PyErr_Clear();
+		return Py_BuildValue("i", -2);
+	}
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	for (i = 0; i < n; i++) {
+		if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, i), &view, PyBUF_SIMPLE) < 0) {
+			PyErr_Clear();
+			Py_DECREF(seq);
+			return Py_BuildValue("i", -2);
+		}
+		ret = nl_put_msg(buf, sizeof(buf), &offset, fd, view.buf, (size_t)view.len, type);
+		PyBuffer_Release(&view);
+		if (ret < 0) {
+			Py_DECREF(seq);
+			return Py_BuildValue("i", -1);
+		}
+	}
+	Py_DECREF(seq);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = pid;
+	addr.nl_groups = group;
+
+	cork = fd_cork[fd];
+	if (cork && cork->active) {
+		nl_cork_lock(cork);
+	} else {
+		cork = NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	if (cork) {
+		nl_cork_flush(fd, cork);
+		pthread_mutex_unlock(&cork->lock);
+	}
+	ret = sendto(fd, buf, offset, 0, (struct sockaddr *)&addr, sizeof(addr));
+	Py_END_ALLOW_THREADS
+	fd_stats[fd].tx_syscalls++;
+	if (ret < 0) {
+		nl_stats_error(&fd_stats[fd], errno);
+		ret = -1;
+	} else {
+		fd_stats[fd].tx_msgs += n;
+		fd_stats[fd].tx_bytes += ret;
+		nl_capture_datagram(fd, NL_CAP_TX, buf, (int)offset, pid, group);
+	}
+	return Py_BuildValue("i", ret);
+}
+
+// recv_batch(fd [, type=0, timestamps=False])
+// Receive one datagram, and return all the messages in it as a list of
+// (data, size, type, flags, seq, pid), or with `timestamps` (..., cpu, ns) as
+// recv(). The messages of other types are dropped. The NLMSG_DONE which ends
+// a multipart reply is kept, with an empty data.
+// If `type` is -1, every message is kept, the NLMSG_ERROR with the struct
+// nlmsgerr as data, and every tuple ends with the service type of the message,
+// None for NLMSG_DONE and NLMSG_ERROR.
+static PyObject* py_nl_recv_batch(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int fd;
+	int ret;
+	int type = DEFAULT_RECV_TYPE;
+	int stype;
+	int timestamps = 0;
+	char buf[MAX_NL_BUFSIZ];
+	PyObject *result, *item, *tail, *full;
+	unsigned char *data;
+	struct nlmsghdr *nlh;
+	Py_ssize_t size;
+	struct sockaddr_nl from;
+	struct nl_stamp stamp;
+	int stamped;
+
+	static char *kwlist[] = {"fd", "type", "timestamps", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|ii", kwlist, &fd, &type, &timestamps)) {
+		return None();
+	}
+	if (fd < 0 || fd >= MAX_FD || type < -1 || type > 255) {
+		return None();
+	}
+
+	memset(&from, 0, sizeof(from));
+	Py_BEGIN_ALLOW_THREADS
+	ret = nl_recv_poll(fd, buf, MAX_NL_BUFSIZ, &from);
+	Py_END_ALLOW_THREADS
+	if (ret < 0) {
+		return None();
+	}
+	nl_capture_datagram(fd, NL_CAP_RX, buf, ret, from.nl_pid, from.nl_groups);
+
+	result = PyList_New(0);
+	if (!result) {
+		return NULL;
+	}
+
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, ret); nlh = NLMSG_NEXT(nlh, ret)) {
+		data = (unsigned char *)NLMSG_DATA(nlh);
+		size = (Py_ssize_t)NLMSG_PAYLOAD(nlh, 0) - 1;
+		stamped = 0;
+		stype = -1;
+		if (nlh->nlmsg_type == NLMSG_DONE && (nlh->nlmsg_flags & NLM_F_MULTI)) {
+			// The end of a multipart reply, e.g. a replay, has no service type.
+			data = (unsigned char *)"";
+			size = 0;
+		} else if (type < 0 && nlh->nlmsg_type == NLMSG_ERROR) {
+			size = (Py_ssize_t)NLMSG_PAYLOAD(nlh, 0);
+		} else if (size < 1 || (type >= 0 && *data != type)) {
+			fd_stats[fd].discards++;
+			continue;
+		} else {
+			stype = *data;
+			data++;
+			stamped = nl_msg_stamp(fd, nlh, &data, &size, &stamp);
+			if (stamped < 0) {
+				fd_stats[fd].discards++;
+				continue;
+			}
+		}
+		fd_stats[fd].rx_msgs++;
+		fd_stats[fd].rx_bytes += nlh->nlmsg_len;
+
+		item = nl_msg_tuple(nlh, data, size, &stamp, stamped, timestamps);
+		if (item && type < 0) {
+			tail = stype < 0 ? Py_BuildValue("(O)", Py_None) : Py_BuildValue("(i)", stype);
+			full = tail ? PySequence_Concat(item, tail) : NULL;
+			Py_XDECREF(tail);
+			Py_DECREF(item);
+			item = full;
+		}
+		if (!item || PyList_Append(result, item) < 0) {
+			Py_XDECREF(item);
+			Py_DECREF(result);
+			return NULL;
+		}
+		Py_DECREF(item);
+	}
+
+	return result;
+}
+
+// stats(fd [, diag=False])
+// Return the counters of the socket as a dict. With diag, also sample
+// rmem_alloc, rcvbuf and drops through NETLINK_SOCK_DIAG, None if not supported.
+static PyObject* py_nl_stats(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int fd;
+	int diag = 0;
+	int i, ret;
+	struct nl_stats st;
+	__u32 meminfo[SK_MEMINFO_VARS];
+	PyObject *result, *upcall_latency, *values;
+	static char *kwlist[] = {"fd", "diag", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|i", kwlist, &fd, &diag)) {
+		return None();
+	}
+	if (fd < 0 || fd >= MAX_FD) {
+		return None();
+	}
+	st = fd_stats[fd];
+
+	upcall_latency = PyTuple_New(NL_LAT_BUCKETS);
+	if (!upcall_latency) {
+		return NULL;
+	}
+	for (i = 0; i < NL_LAT_BUCKETS; i++) {
+		PyTuple_SET_ITEM(upcall_latency, i, PyLong_FromUnsignedLongLong(st.upcall_latency[i]));
+	}
+
+	result = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:d,s:K,s:K,s:K,s:K,s:N}",
+			"tx_msgs", st.tx_msgs, "tx_bytes", st.tx_bytes, "tx_syscalls", st.tx_syscalls,
+			"rx_msgs", st.rx_msgs, "rx_bytes", st.rx_bytes, "rx_syscalls", st.rx_syscalls,
+			"eagain", st.eagain, "enobufs", st.enobufs, "errors", st.errors,
+			"discards", st.discards, "cork_msgs", st.cork_msgs,
+			"cork_datagrams", st.cork_datagrams, "cork_deadline", st.cork_deadline,
+			"coalescing", st.cork_datagrams ? (double)st.cork_msgs / st.cork_datagrams : 0.0,
+			"poll_hits", st.poll_hits, "poll_misses", st.poll_misses,
+			"poll_spin_ns", st.poll_spin_ns, "poll_budget_ns", fd_poll[fd].budget,
+			"upcall_latency_ns", upcall_latency);
+	if (!result || !diag) {
+		return result;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = nl_diag_meminfo(fd, meminfo);
+	Py_END_ALLOW_THREADS
+	if (ret < 0) {
+		values = Py_BuildValue("{s:O,s:O,s:O}", "rmem_alloc", Py_None, "rcvbuf", Py_None,
+				"drops", Py_None);
+	} else {
+		values = Py_BuildValue("{s:I,s:I,s:I}", "rmem_alloc", meminfo[SK_MEMINFO_RMEM_ALLOC],
+				"rcvbuf", meminfo[SK_MEMINFO_RCVBUF], "drops", meminfo[SK_MEMINFO_DROPS]);
+	}
+	if (!values || PyDict_Update(result, values) < 0) {
+		Py_XDECREF(values);
+		Py_DECREF(result);
+		return NULL;
+	}
+	Py_DECREF(values);
+	return result;
+}
+
+// cork(fd [, max_bytes=MAX_NL_BUFSIZ, max_msgs=64, delay_us=50])
+// Stage the messages of send() and send them in one datagram, when it reaches
+// max_bytes or max_msgs, when its first message has waited delay_us (0 means
+// never), or on flush(). If already corked, flush and take the new limits.
+// Return True, or False if failed.
+static PyObject* py_nl_cork(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int fd;
+	unsigned long max_bytes = MAX_NL_BUFSIZ;
+	unsigned int max_msgs = 64;
+	double delay_us = 50;
+	struct nl_cork *cork;
+	static char *kwlist[] = {"fd", "max_bytes", "max_msgs", "delay_us", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|kId", kwlist, &fd, &max_bytes, &max_msgs, &delay_us)) {
+		return NULL;
+	}
+	if (max_msgs < 1 || delay_us < 0) {
+		PyErr_SetString(PyExc_ValueError, "max_msgs must be positive, and delay_us not negative");
+		return NULL;
+	}
+	if (fd < 0 || fd >= MAX_FD) {
+		Py_RETURN_FALSE;
+	}
+
+	cork = nl_cork_get(fd);
+	if (!cork) {
+		Py_RETURN_FALSE;
+	}
+
+	nl_cork_lock(cork);
+	Py_BEGIN_ALLOW_THREADS
+	nl_cork_flush(fd, cork);
+	Py_END_ALLOW_THREADS
+	cork->max_bytes = max_bytes;
+	cork->max_msgs = max_msgs;
+	cork->delay = (uint64_t)(delay_us * 1000);
+	cork->active = 1;
+	pthread_mutex_unlock(&cork->lock);
+	Py_RETURN_TRUE;
+}
+
+// flush(fd)
+// Send the staged messages. Return the byte number sent, 0 if nothing is
+// staged or the socket is not corked, or -1 if failed.
+static PyObject* py_nl_flush(PyObject *self, PyObject *args)
+{
+	int fd;
+	int ret = 0;
+	struct nl_cork *cork;
+
+	if (!PyArg_ParseTuple(args, "i", &fd)) {
+		return NULL;
+	}
+	if (fd < 0 || fd >= MAX_FD) {
+		return Py_BuildValue("i", -1);
+	}
+
+	cork = fd_cork[fd];
+	if (cork && cork->active) {
+		nl_cork_lock(cork);
+		Py_BEGIN_ALLOW_THREADS
+		ret = nl_cork_flush(fd, cork);
+		pthread_mutex_unlock(&cork->lock);
+		Py_END_ALLOW_THREADS
+	}
+	return Py_BuildValue("i", ret);
+}
+
+// uncork(fd)
+// Send the staged messages and stop corking. Return as flush().
+static PyObject* py_nl_uncork(PyObject *self, PyObject *args)
+{
+	int fd;
+
+	if (!PyArg_ParseTuple(args, "i", &fd)) {
+		return NULL;
+	}
+	if (fd < 0 || fd >= MAX_FD) {
+		return Py_BuildValue("i", -1);
+	}
+
+	return Py_BuildValue("i", nl_cork_stop(fd));
+}
+
+// busy_poll(fd [, budget_us=50, adaptive=True])
+// Spin for up to budget_us before blocking in recv() and recv_batch(), 0
+// means never. If adaptive, spin only as long as the recent intervals between
+// the datagrams ask for. Return True, or False if the fd is out of range.
+static PyObject* py_nl_busy_poll(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int fd;
+	double budget_us = 50;
+	int adaptive = 1;
+	struct nl_poll *p;
+	static char *kwlist[] = {"fd", "budget_us", "adaptive", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|di", kwlist, &fd, &budget_us, &adaptive)) {
+		return NULL;
+	}
+	if (budget_us < 0) {
+		PyErr_SetString(PyExc_ValueError, "budget_us must not be negative");
+		return NULL;
+	}
+	if (fd < 0 || fd >= MAX_FD) {
+		Py_RETURN_FALSE;
+	}
+
+	p = &fd_poll[fd];
+	memset(p, 0, sizeof(*p));
+	p->max_budget = (uint64_t)(budget_us * 1000);
+	p->budget = p->max_budget;
+	p->adaptive = adaptive;
+	Py_RETURN_TRUE;
+}
+
+// Join or leave, according to `opt`, the multicast group `group` of the
+// socket. Return True, or False if failed, e.g. the group is beyond the
+// groups of the protocol.
+static PyObject* nl_membership(PyObject *args, int opt)
+{
+	int fd;
+	unsigned int group;
+
+	if (!PyArg_ParseTuple(args, "iI", &fd, &group)) {
+		return NULL;
+	}
+	// The groups start from 1.
+	if (group == 0 || fd < 0 || fd >= MAX_FD) {
+		Py_RETURN_FALSE;
+	}
+
+	if (setsockopt(fd, SOL_NETLINK, opt, &group, sizeof(group)) < 0) {
+		Py_RETURN_FALSE;
+	}
+	Py_RETURN_TRUE;
+}
+
+// join_group(fd, group)
+// Receive the messages broadcast to the group `group`, a number and not a mask,
+// which may be beyond the 32 groups of the mask of create().
+static PyObject* py_nl_join_group(PyObject *self, PyObject *args)
+{
+	return nl_membership(args, NETLINK_ADD_MEMBERSHIP);
+}
+
+// leave_group(fd, group)
+// Stop receiving the messages of the group `group`, which the socket has
+// joined by join_group() or by the mask of create(). The messages already
+// queued are kept.
+static PyObject* py_nl_leave_group(PyObject *self, PyObject *args)
+{
+	return nl_membership(args, NETLINK_DROP_MEMBERSHIP);
+}
+
+// capture(fd, path)
+// Record every message which the socket sends or receives into the file `path`.
+// Return True, or False if the file cannot be created.
+static PyObject* py_nl_capture(PyObject *self, PyObject *args)
+{
+	int fd;
+	char *path;
+
+	if (!PyArg_ParseTuple(args, "is", &fd, &path)) {
+		return NULL;
+	}
+	if (fd < 0 || fd >= MAX_FD) {
+		Py_RETURN_FALSE;
+	}
+
+	nl_capture_stop(fd);
+	if (nl_capture_start(fd, path) < 0) {
+		Py_RETURN_FALSE;
+	}
+	Py_RETURN_TRUE;
+}
+
+// capture_stop(fd)
+// Stop the capture. Return the number of the records, or -1 if an error (e.g.
+// the disk is full) has stopped recording before.
+static PyObject* py_nl_capture_stop(PyObject *self, PyObject *args)
+{
+	int fd;
+
+	if (!PyArg_ParseTuple(args, "i", &fd)) {
+		return NULL;
+	}
+	if (fd < 0 || fd >= MAX_FD) {
+		return Py_BuildValue("l", 0L);
+	}
+	return Py_BuildValue("l", nl_capture_stop(fd));
+}
+
+// relay_create(name [, nslots=4096, slot_size=2048])
+// Create the shared memory ring `name` (e.g. "/nlrelay") as its producer.
+// Return a handle, or -1 if failed.
+static PyObject* py_nl_relay_create(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	char *name;
+	unsigned long nslots = 4096;
+	unsigned long slot_size = 2048;
+	struct nl_relay *relay;
+	int h;
+	static char *kwlist[] = {"name", "nslots", "slot_size", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "s|kk", kwlist, &name, &nslots, &slot_size)) {
+		return NULL;
+	}
+	if (!nslots || (nslots & (nslots - 1)) || slot_size <= sizeof(struct nl_relay_slot)
+			|| slot_size > NLMSG_SPACE(MAX_PAYLOAD) + sizeof(struct nl_relay_slot)) {
+		PyErr_SetString(PyExc_ValueError, "nslots must be a power of 2, and slot_size hold a message");
+		return NULL;
+	}
+
+	for (h = 0; h < NL_RELAY_MAX && relays[h]; h++)
+		;
+	if (h == NL_RELAY_MAX) {
+		return Py_BuildValue("i", -1);
+	}
+
+	relay = nl_relay_map(name, 1, nslots, (slot_size + 7) & ~7UL);
+	if (!relay) {
+		return Py_BuildValue("i", -1);
+	}
+	relays[h] = relay;
+	return Py_BuildValue("i", h);
+}
+
+// relay_attach(name [, oldest=False])
+// Attach to the ring `name` as a consumer, which reads from the next message,
+// or from the oldest one still in the ring. Return a handle, or -1 if failed.
+static PyObject* py_nl_relay_attach(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	char *name;
+	int oldest = 0;
+	struct nl_relay *relay;
+	uint64_t head;
+	int h;
+	static char *kwlist[] = {"name", "oldest", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "s|i", kwlist, &name, &oldest)) {
+		return NULL;
+	}
+
+	for (h = 0; h < NL_RELAY_MAX && relays[h]; h++)
+		;
+	if (h == NL_RELAY_MAX) {
+		return Py_BuildValue("i", -1);
+	}
+
+	relay = nl_relay_map(name, 0, 0, 0);
+	if (!relay) {
+		return Py_BuildValue("i", -1);
+	}
+	head = __atomic_load_n(&relay->hdr->head, __ATOMIC_ACQUIRE);
+	relay->cursor = head;
+	if (oldest) {
+		relay->cursor = head > relay->hdr->nslots ? head - relay->hdr->nslots : 0;
+	}
+	relays[h] = relay;
+	return Py_BuildValue("i", h);
+}
+
+// relay_pump(h, fd [, block=True])
+// Receive a datagram from the netlink socket `fd` and write its messages into
+// the ring. Return the number of the messages, or -1 if recv failed.
+static PyObject* py_nl_relay_pump(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int h, fd, ret;
+	int block = 1;
+	struct nl_relay *relay;
+	static char *kwlist[] = {"h", "fd", "block", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "ii|i", kwlist, &h, &fd, &block)) {
+		return NULL;
+	}
+	relay = nl_relay_get(h);
+	if (!relay || !relay->producer || fd < 0 || fd >= MAX_FD) {
+		return Py_BuildValue("i", -1);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = nl_relay_pump(relay, fd, block ? 0 : MSG_DONTWAIT);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
+}
+
+// relay_read(h [, max=64, timeout=0.0, type=-1])
+// Read at most `max` messages from the ring, as a list of
+// (data, size, type, flags, seq, pid) like recv_batch. If `type` is not -1,
+// the messages of the other service types are skipped. Wait up to `timeout`
+// seconds (for ever if negative) if there is no message.
+static PyObject* py_nl_relay_read(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int h;
+	int max = 64;
+	int type = -1;
+	double timeout = 0.0;
+	struct nl_relay *relay;
+	struct nl_relay_header *hdr;
+	struct nl_relay_slot *slot;
+	struct timespec now, deadline, wait;
+	uint64_t head, seq;
+	uint32_t gen, size;
+	PyObject *result, *item;
+	int ret;
+	static char *kwlist[] = {"h", "max", "timeout", "type", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|idi", kwlist, &h, &max, &timeout, &type)) {
+		return NULL;
+	}
+	relay = nl_relay_get(h);
+	if (!relay || relay->producer) {
+		return None();
+	}
+	hdr = relay->hdr;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	if (timeout > 0) {
+		deadline.tv_sec += (time_t)timeout;
+		deadline.tv_nsec += (long)((timeout - (time_t)timeout) * 1e9);
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	result = PyList_New(0);
+	if (!result) {
+		return NULL;
+	}
+
+	for (;;) {
+		// Read the generation before the head, so that no wake-up is missed.
+		gen = __atomic_load_n(&hdr->futex, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		if (head - relay->cursor > hdr->nslots) {
+			relay->overruns += head - hdr->nslots - relay->cursor;
+			relay->cursor = head - hdr->nslots;
+		}
+
+		while (relay->cursor < head && PyList_GET_SIZE(result) < max) {
+			slot = nl_relay_slot(hdr, relay->cursor);
+			seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+			size = slot->size;
+			if (seq != relay->cursor + 1 || sizeof(*slot) + size > hdr->slot_size) {
+				// Overwritten, or being overwritten, by the producer.
+				relay->overruns++;
+				relay->cursor++;
+				continue;
+			}
+			if (type >= 0 && slot->type != type) {
+				relay->cursor++;
+				continue;
+			}
+
+			item = Py_BuildValue("(" BYTES_FMT "kHHkk)", (char *)(slot + 1), (Py_ssize_t)size,
+					(unsigned long)size, slot->nlmsg_type, slot->flags,
+					(unsigned long)slot->msg_seq, (unsigned long)slot->pid);
+			if (!item) {
+				Py_DECREF(result);
+				return NULL;
+			}
+
+			// The copy is good only if the slot has not been reused meanwhile.
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+				Py_DECREF(item);
+				relay->overruns++;
+				relay->cursor++;
+				continue;
+			}
+
+			relay->cursor++;
+			relay->reads++;
+			ret = PyList_Append(result, item);
+			Py_DECREF(item);
+			if (ret < 0) {
+				Py_DECREF(result);
+				return NULL;
+			}
+		}
+
+		if (PyList_GET_SIZE(result) || timeout == 0 || relay->cursor < head) {
+			break;
+		}
+
+		if (timeout > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			wait.tv_sec = deadline.tv_sec - now.tv_sec;
+			wait.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if (wait.tv_nsec < 0) {
+				wait.tv_sec--;
+				wait.tv_nsec += 1000000000L;
+			}
+			if (wait.tv_sec < 0) {
+				break;
+			}
+		}
+
+		__atomic_add_fetch(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
+		Py_BEGIN_ALLOW_THREADS
+		ret = syscall(SYS_futex, &hdr->futex, FUTEX_WAIT, gen, timeout > 0 ? &wait : NULL, NULL, 0);
+		Py_END_ALLOW_THREADS
+		__atomic_sub_fetch(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
+		if (ret < 0 && errno == EINTR && PyErr_CheckSignals() < 0) {
+			Py_DECREF(result);
+			return NULL;
+		}
+	}
+
+	return result;
+}
+
+// relay_stats(h)
+// Return the state of the ring, and the lag and the overruns of a consumer.
+static PyObject* py_nl_relay_stats(PyObject *self, PyObject *args)
+{
+	int h;
+	struct nl_relay *relay;
+	uint64_t head;
+
+	if (!PyArg_ParseTuple(args, "i", &h)) {
+		return NULL;
+	}
+	relay = nl_relay_get(h);
+	if (!relay) {
+		return None();
+	}
+
+	head = __atomic_load_n(&relay->hdr->head, __ATOMIC_ACQUIRE);
+	if (relay->producer) {
+		return Py_BuildValue("{s:K,s:K,s:K,s:I}", "head", head, "dropped", relay->hdr->dropped,
+				"nslots", relay->hdr->nslots, "slot_size", relay->hdr->slot_size);
+	}
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:I}", "head", head,
+			"dropped", relay->hdr->dropped, "nslots", relay->hdr->nslots,
+			"cursor", relay->cursor, "lag", head - relay->cursor,
+			"reads", relay->reads, "overruns", relay->overruns,
+			"slot_size", relay->hdr->slot_size);
+}
+
+// relay_close(h)
+// Detach from the ring. The producer also removes it.
+static PyObject* py_nl_relay_close(PyObject *self, PyObject *args)
+{
+	int h;
+	struct nl_relay *relay;
+
+	if (!PyArg_ParseTuple(args, "i", &h)) {
+		return NULL;
+	}
+	relay = nl_relay_get(h);
+	if (relay) {
+		relays[h] = NULL;
+		nl_relay_unmap(relay);
+	}
+	return None();
+}
+
+// decode_records(type, data [, columnar=False])
+// Decode the records of the service type `type`, which is described in
+// test_netlink_schema.h. `data` is the payload of a message, or a sequence
+// of the payloads or of the tuples of recv() and recv_batch(). Return a list
+// of tuples in the order of the fields, or with columnar, a dict of the field
+// name to an array.array, which numpy.frombuffer() takes without a copy.
+static PyObject* py_nl_decode_records(PyObject *self, PyObject *args, PyObject *keywds)
+{
+	int type;
+	int columnar = 0;
+	PyObject *data, *result;
+	struct nl_schema *s;
+	Py_buffer *views;
+	Py_ssize_t i, n, count = 0;
+	static char *kwlist[] = {"type", "data", "columnar", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "iO|i", kwlist, &type, &data, &columnar)) {
+		return NULL;
+	}
+	s = nl_schema_find(type);
+	if (!s) {
+		PyErr_Format(PyExc_ValueError, "no schema of the service type %d", type);
+		return NULL;
+	}
+
+	n = nl_schema_buffers(data, s->size, &views);
+	if (n < 0) {
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		count += views[i].len / s->size;
+	}
+
+	if (columnar) {
+		result = nl_schema_columns(s, views, n, count);
+	} else {
+		result = nl_schema_tuples(s, views, n, count);
+	}
+	nl_schema_release(views, n);
+	return result;
+}
+
+// schemas()
+// Return a dict of the service type to (name, record size, ((field, code), ...)).
+static PyObject* py_nl_schemas(PyObject *self, PyObject *args)
+{
+	PyObject *result, *fields, *value, *key;
+	struct nl_schema *s;
+	size_t i;
+	int j;
+
+	nl_schema_layout();
+	result = PyDict_New();
+	if (!result) {
+		return NULL;
+	}
+	for (i = 0; i < NL_SCHEMA_NUM; i++) {
+		s = &nl_schemas[i];
+		fields = PyTuple_New(s->nfields);
+		if (!fields) {
+			Py_DECREF(result);
+			return NULL;
+		}
+		for (j = 0; j < s->nfields; j++) {
+			value = Py_BuildValue("(ss)", s->fields[j].name, s->fields[j].code);
+			if (!value) {
+				Py_DECREF(fields);
+				Py_DECREF(result);
+				return NULL;
+			}
+			PyTuple_SET_ITEM(fields, j, value);
+		}
+		value = Py_BuildValue("(snN)", s->name, (Py_ssize_t)s->size, fields);
+		key = Py_BuildValue("i", s->type);
+		if (!value || !key || PyDict_SetItem(result, key, value) < 0) {
+			Py_XDECREF(value);
+			Py_XDECREF(key);
+			Py_DECREF(result);
+			return NULL;
+		}
+		Py_DECREF(value);
+		Py_DECREF(key);
+	}
+	return result;
+}
+
+// close(fd)
+static PyObject* py_nl_close(PyObject *self, PyObject *args)
+{
+	int fd;
+	if (!PyArg_ParseTuple(args, "i", &fd)) {
+		return None();
+	}
+	if (fd >= 0 && fd < MAX_FD) {
+		nl_cork_stop(fd);
+		nl_capture_stop(fd);
 	}
 	close(fd);
 	return None();
@@ -213,6 +2323,25 @@ static PyMethodDef NetlinkMethods[] = {
 	{"create", (PyCFunction)py_nl_create, METH_VARARGS|METH_KEYWORDS, "create a netlink socket"},
 	{"recv", (PyCFunction)py_nl_recv, METH_VARARGS|METH_KEYWORDS, "receive a netlink service message from the kernel or the userspace"},
 	{"send", (PyCFunction)py_nl_send, METH_VARARGS|METH_KEYWORDS, "send a netlink service message to the kernel or the userspace"},
+	{"send_batch", (PyCFunction)py_nl_send_batch, METH_VARARGS|METH_KEYWORDS, "send many netlink service messages in one datagram"},
+	{"recv_batch", (PyCFunction)py_nl_recv_batch, METH_VARARGS|METH_KEYWORDS, "receive all the netlink service messages in one datagram"},
+	{"stats", (PyCFunction)py_nl_stats, METH_VARARGS|METH_KEYWORDS, "the counters of the netlink socket"},
+	{"cork", (PyCFunction)py_nl_cork, METH_VARARGS|METH_KEYWORDS, "stage the sent messages and send them in one datagram"},
+	{"flush", (PyCFunction)py_nl_flush, METH_VARARGS, "send the staged messages"},
+	{"uncork", (PyCFunction)py_nl_uncork, METH_VARARGS, "send the staged messages and stop corking"},
+	{"busy_poll", (PyCFunction)py_nl_busy_poll, METH_VARARGS|METH_KEYWORDS, "spin before blocking in recv"},
+	{"join_group", (PyCFunction)py_nl_join_group, METH_VARARGS, "join a multicast group"},
+	{"leave_group", (PyCFunction)py_nl_leave_group, METH_VARARGS, "leave a multicast group"},
+	{"capture", (PyCFunction)py_nl_capture, METH_VARARGS, "record the messages of the netlink socket into a file"},
+	{"capture_stop", (PyCFunction)py_nl_capture_stop, METH_VARARGS, "stop recording the messages of the netlink socket"},
+	{"relay_create", (PyCFunction)py_nl_relay_create, METH_VARARGS|METH_KEYWORDS, "create a shared memory ring as its producer"},
+	{"relay_attach", (PyCFunction)py_nl_relay_attach, METH_VARARGS|METH_KEYWORDS, "attach to a shared memory ring as a consumer"},
+	{"relay_pump", (PyCFunction)py_nl_relay_pump, METH_VARARGS|METH_KEYWORDS, "move the messages of a datagram into the ring"},
+	{"relay_read", (PyCFunction)py_nl_relay_read, METH_VARARGS|METH_KEYWORDS, "read the messages from the ring"},
+	{"relay_stats", (PyCFunction)py_nl_relay_stats, METH_VARARGS, "the state of the ring and of the consumer"},
+	{"relay_close", (PyCFunction)py_nl_relay_close, METH_VARARGS, "detach from the ring"},
+	{"decode_records", (PyCFunction)py_nl_decode_records, METH_VARARGS|METH_KEYWORDS, "decode a batch of the fixed-layout records of a service type"},
+	{"schemas", (PyCFunction)py_nl_schemas, METH_VARARGS, "the fixed-layout records of the service types"},
 	{"close", (PyCFunction)py_nl_close, METH_VARARGS, "close the netlink socket"},
 	{NULL, NULL, 0, NULL},
 };
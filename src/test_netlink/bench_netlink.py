@@ -0,0 +1,196 @@
+# coding: utf-8
+"""Throughput and latency benchmark of the _netlink extension.
+
+The peers are userspace sockets talking over NETLINK_USERSOCK, so no kernel
+module is needed. Every combination of message size, batch size (messages per
+datagram) and thread count (independent sender/receiver pairs) is measured in
+two modes:
+
+    oneway  the sender streams batches, the receiver measures the latency
+            from the send time stamped into every message;
+    corked  as oneway, but the sender sends the messages one by one through
+            a corked socket (Netlink.cork), which coalesces `batch` of them;
+    rtt     the client sends a batch and waits until an echo server returns
+            it, the latency is per batch.
+
+The results are printed as JSON.
+
+Usage: python bench_netlink.py [--sizes 16,256,4096] [--batches 1,16]
+                               [--threads 1,2] [--modes oneway,corked,rtt]
+                               [--count 20000] [--output FILE]
+"""
+from __future__ import division, print_function
+
+import argparse
+import itertools
+import json
+import os
+import struct
+import threading
+import time
+
+import netlink
+
+NETLINK_USERSOCK = 2
+
+# The largest datagram which _netlink.recv_batch can receive.
+MAX_DATAGRAM = 60000
+
+STAMP = struct.Struct("d")
+clock = getattr(time, "perf_counter", time.time)
+
+_pids = itertools.count(((os.getpid() & 0xFFFFF) << 10) + 1)
+
+
+def socket_pair():
+    a, b = next(_pids), next(_pids)
+    rx = netlink.Netlink(pid=a, group=0, dst_pid=b, protocol=NETLINK_USERSOCK)
+    tx = netlink.Netlink(pid=b, group=0, dst_pid=a, protocol=NETLINK_USERSOCK)
+    return rx, tx
+
+
+def datagram_size(size, batch):
+    # nlmsghdr + the type byte + the payload, aligned to 4 bytes.
+    return batch * ((16 + 1 + size + 3) & ~3)
+
+
+def message(size):
+    return STAMP.pack(clock()) + b"\x00" * (size - STAMP.size)
+
+
+def receive(sock, count, latencies):
+    received = 0
+    while received < count:
+        msgs = sock.recv_batch()
+        if msgs is None:
+            raise RuntimeError("recv_batch failed")
+        now = clock()
+        for data, _, _, _, _, _ in msgs:
+            latencies.append(now - STAMP.unpack_from(data)[0])
+        received += len(msgs)
+
+
+def oneway(size, batch, count, latencies):
+    rx, tx = socket_pair()
+    receiver = threading.Thread(target=receive, args=(rx, count, latencies))
+    receiver.start()
+    for _ in range(count // batch):
+        if tx.send_batch([message(size) for _ in range(batch)]) < 0:
+            raise RuntimeError("send_batch failed")
+    receiver.join()
+    rx.close()
+    tx.close()
+
+
+def corked(size, batch, count, latencies):
+    rx, tx = socket_pair()
+    receiver = threading.Thread(target=receive, args=(rx, count, latencies))
+    receiver.start()
+    tx.cork(max_msgs=batch)
+    for _ in range(count):
+        if tx.send(message(size), size) < 0:
+            raise RuntimeError("send failed")
+    tx.flush()
+    receiver.join()
+    rx.close()
+    tx.close()
+
+
+def echo(sock, count):
+    served = 0
+    while served < count:
+        msgs = sock.recv_batch()
+        if msgs:
+            sock.send_batch([m[0] for m in msgs])
+            served += len(msgs)
+
+
+def rtt(size, batch, count, latencies):
+    server, client = socket_pair()
+    echoer = threading.Thread(target=echo, args=(server, count))
+    echoer.start()
+    for _ in range(count // batch):
+        start = clock()
+        if client.send_batch([message(size) for _ in range(batch)]) < 0:
+            raise RuntimeError("send_batch failed")
+        received = 0
+        while received < batch:
+            received += len(client.recv_batch())
+        latencies.append(clock() - start)
+    echoer.join()
+    server.close()
+    client.close()
+
+
+MODES = {"oneway": oneway, "corked": corked, "rtt": rtt}
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    return values[min(len(values) - 1, int(len(values) * p))] * 1e6
+
+
+def run(mode, size, batch, threads, count):
+    count = count // batch * batch
+    latencies = [[] for _ in range(threads)]
+    workers = [threading.Thread(target=MODES[mode], args=(size, batch, count, latencies[i]))
+               for i in range(threads)]
+
+    start = clock()
+    for t in workers:
+        t.start()
+    for t in workers:
+        t.join()
+    elapsed = clock() - start
+
+    total = count * threads
+    merged = sorted(itertools.chain.from_iterable(latencies))
+    return {
+        "mode": mode,
+        "size": size,
+        "batch": batch,
+        "threads": threads,
+        "messages": total,
+        "seconds": elapsed,
+        "msgs_per_sec": total / elapsed,
+        "mb_per_sec": total * size / elapsed / 1e6,
+        "latency_us": {
+            "p50": percentile(merged, 0.50),
+            "p99": percentile(merged, 0.99),
+            "p999": percentile(merged, 0.999),
+        },
+    }
+
+
+def ints(text):
+    return [int(n) for n in text.split(",")]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--sizes", type=ints, default=[16, 256, 4096])
+    parser.add_argument("--batches", type=ints, default=[1, 16])
+    parser.add_argument("--threads", type=ints, default=[1, 2])
+    parser.add_argument("--modes", default="oneway,corked,rtt")
+    parser.add_argument("--count", type=int, default=20000)
+    parser.add_argument("--output")
+    args = parser.parse_args()
+
+    results = []
+    for mode in args.modes.split(","):
+        for size, batch, threads in itertools.product(args.sizes, args.batches, args.threads):
+            if size < STAMP.size or datagram_size(size, batch) > MAX_DATAGRAM:
+                continue
+            results.append(run(mode, size, batch, threads, args.count))
+
+    report = json.dumps(results, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(report)
+    else:
+        print(report)
+
+
+if __name__ == "__main__":
+    main()
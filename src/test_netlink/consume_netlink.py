@@ -0,0 +1,53 @@
+# coding: utf-8
+"""Consume the upcalls of test_netlink and print the received rate every second.
+
+Used together with test_netlink_loadgen.ko as an end-to-end benchmark of the
+kernel-to-user path. By default it receives what the load generator sends with
+its default parameters, that's, unicast to the pid 1.
+
+Usage: python consume_netlink.py [--pid 1] [--group 1] [--join N ...] [--type 0]
+                                 [--duration 10]
+"""
+from __future__ import division, print_function
+
+import argparse
+import time
+
+import netlink
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--pid", type=int, default=netlink.DEFAULT_PID)
+    parser.add_argument("--group", type=int, default=netlink.DEFAULT_GROUP,
+                        help="the mask of the groups 1 to 32")
+    parser.add_argument("--join", type=int, action="append", default=[],
+                        help="join the group N, which may be above 32")
+    parser.add_argument("--type", type=int, default=netlink.DEFAULT_RECV_TYPE)
+    parser.add_argument("--duration", type=float, default=10)
+    args = parser.parse_args()
+
+    sock = netlink.Netlink(pid=args.pid, group=args.group)
+    for group in args.join:
+        if not sock.join_group(group):
+            raise SystemExit("Failed to join the group %d" % group)
+    start = last = time.time()
+    msgs = nbytes = 0
+    total = 0
+    while last - start < args.duration:
+        batch = sock.recv_batch(args.type)
+        if batch:
+            msgs += len(batch)
+            nbytes += sum(m[1] for m in batch)
+        now = time.time()
+        if now - last >= 1:
+            print("%10.0f msgs/s %10.2f MB/s" % (msgs / (now - last), nbytes / (now - last) / 1e6))
+            total += msgs
+            msgs = nbytes = 0
+            last = now
+    print("received %d messages" % total)
+    sock.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -1,6 +1,8 @@
 # coding: utf-8
 from __future__ import absolute_import, print_function
 
+import struct
+
 import _netlink
 
 NETLINK_PROTOCOL = 30
@@ -14,10 +16,25 @@ DEFAULT_DEST_GROUP = 0
 DEFAULT_SEND_TYPE = 0
 DEFAULT_RECV_TYPE = 0
 
+NLMSG_ERROR = 2
+NLMSG_DONE = 3
+NLM_F_MULTI = 2
+
+# The flag of the upcalls which carry the CPU and the time of the upcall.
+NL_F_TIMESTAMP = 0x1000
+
+# The service types of the fixed-layout records in test_netlink_schema.h.
+TYPE_REPLAY = 14
+TYPE_TELEMETRY = 16
+TYPE_COUNTER = 17
+
 
 def create(pid=DEFAULT_PID, group=DEFAULT_GROUP, protocol=NETLINK_PROTOCOL):
     """Create a Netlink Socket.
 
+    `group` is the mask of the groups 1 to 32 which the socket joins, see
+    join_group() for the others.
+
     If argument error, return -1; if the linux kernel failed to create the
     netlink socket, return -2; if the file description is more than the max
     value, return -3; If successfully, return a positive number.
@@ -25,9 +42,15 @@ def create(pid=DEFAULT_PID, group=DEFAULT_GROUP, protocol=NETLINK_PROTOCOL):
     return _netlink.create(pid=pid, group=group, protocol=protocol)
 
 
-def recv(fd, type=DEFAULT_RECV_TYPE):
-    """Return a tuple, that's, (data, size, type, flags, seq, pid)."""
-    return _netlink.recv(fd, type)
+def recv(fd, type=DEFAULT_RECV_TYPE, timestamps=False):
+    """Return a tuple, that's, (data, size, type, flags, seq, pid).
+
+    If timestamps is True, return (data, size, type, flags, seq, pid, cpu, ns),
+    where cpu and ns are the CPU and the CLOCK_MONOTONIC time in ns of the
+    upcall, or None if the service type is not stamped by the kernel
+    (set_service_timestamp). The stamp is never part of the data.
+    """
+    return _netlink.recv(fd, type, timestamps)
 
 
 def send(fd, data, size, type=DEFAULT_SEND_TYPE, pid=DEFAULT_DEST_PID, group=DEFAULT_DEST_GROUP):
@@ -35,6 +58,179 @@ def send(fd, data, size, type=DEFAULT_SEND_TYPE, pid=DEFAULT_DEST_PID, group=DEF
     return _netlink.send(fd, data, size, pid, group, type)
 
 
+def send_batch(fd, msgs, type=DEFAULT_SEND_TYPE, pid=DEFAULT_DEST_PID, group=DEFAULT_DEST_GROUP):
+    """Send all the messages in one datagram.
+
+    Return the byte number sent in fact. If failed, return a negative number.
+    """
+    return _netlink.send_batch(fd, msgs, pid, group, type)
+
+
+def recv_batch(fd, type=DEFAULT_RECV_TYPE, timestamps=False):
+    """Return a list of (data, size, type, flags, seq, pid), which are all
+    the messages in the next datagram, or of (..., cpu, ns) as recv() if
+    timestamps is True.
+
+    If type is None, the messages of every service type are kept, and every
+    tuple ends with the service type of the message; the NLMSG_ERROR are kept
+    too, with the struct nlmsgerr as data. The service type of NLMSG_DONE and
+    NLMSG_ERROR is None.
+    """
+    return _netlink.recv_batch(fd, -1 if type is None else type, timestamps)
+
+
+def stats(fd, diag=False):
+    """Return the counters of the socket as a dict.
+
+    The counters are tx_msgs, tx_bytes, tx_syscalls, rx_msgs, rx_bytes,
+    rx_syscalls, eagain, enobufs, errors and discards (the messages of another
+    type); cork_msgs, cork_datagrams, cork_deadline (the datagrams sent by the
+    deadline of cork()) and coalescing, the messages per corked datagram;
+    poll_hits, poll_misses, poll_spin_ns and poll_budget_ns (the current
+    budget) of busy_poll(); and upcall_latency_ns, the histogram of the time
+    from the upcall in the kernel to the delivery, whose bucket i counts
+    [2**i, 2**(i+1)) ns, for the service types stamped by the kernel (see
+    recv() and set_service_timestamp in test_netlink.h). If diag is
+    True, also sample rmem_alloc, rcvbuf and drops of the socket from the
+    kernel, which is a few syscalls more.
+    """
+    return _netlink.stats(fd, diag)
+
+
+def cork(fd, max_bytes=None, max_msgs=64, delay_us=50):
+    """Stage the messages of send() and send them in one datagram.
+
+    The datagram is sent when it reaches max_bytes (by default, as large as
+    possible) or max_msgs, when its first message has waited delay_us (0 means
+    never), when a message to another destination is sent, or on flush().
+    While corked, send() returns the size of the staged message, or -1 if it
+    is too large or sending the datagram before it has failed, in which case
+    the message is not staged and may be sent again; a datagram sent by the
+    deadline only reports its failure in stats(). Return True, or False if
+    failed.
+    """
+    if max_bytes is None:
+        return _netlink.cork(fd, max_msgs=max_msgs, delay_us=delay_us)
+    return _netlink.cork(fd, max_bytes, max_msgs, delay_us)
+
+
+def flush(fd):
+    """Send the staged messages. Return the byte number sent, 0 if nothing is
+    staged, or -1 if failed."""
+    return _netlink.flush(fd)
+
+
+def uncork(fd):
+    """Send the staged messages and stop corking. Return as flush()."""
+    return _netlink.uncork(fd)
+
+
+def busy_poll(fd, budget_us=50, adaptive=True):
+    """Spin for up to budget_us before blocking in recv() and recv_batch(),
+    which trades the CPU for the latency of the wakeup; 0 disables it.
+
+    If adaptive, the budget follows the recent intervals between the
+    datagrams: it is twice the expected interval, and nothing if they come
+    further apart than budget_us. stats() reports how often the spin has got
+    a datagram. Return True, or False if failed.
+    """
+    return _netlink.busy_poll(fd, budget_us, adaptive)
+
+
+def join_group(fd, group):
+    """Receive the messages broadcast to the multicast group `group`.
+
+    Unlike the `group` mask of create(), which covers the groups 1 to 32,
+    `group` is a number and may go up to the groups of the protocol (the
+    `groups` parameter of the test_netlink module). The membership changes
+    without recreating the socket, so no queued message is lost. The groups
+    start from 1. Return True, or False if failed.
+    """
+    return _netlink.join_group(fd, group)
+
+
+def leave_group(fd, group):
+    """Stop receiving the messages of the multicast group `group`, joined by
+    join_group() or by the mask of create(). Return True, or False if failed.
+    """
+    return _netlink.leave_group(fd, group)
+
+
+def capture(fd, path):
+    """Record every message which the socket sends or receives into the file
+    `path`, which nlreplay reads. Return True, or False if failed."""
+    return _netlink.capture(fd, path)
+
+
+def capture_stop(fd):
+    """Stop the capture. Return the number of the records, or -1 if an error
+    (e.g. the disk is full) has stopped recording before."""
+    return _netlink.capture_stop(fd)
+
+
+def replay(fd, type, seq):
+    """Ask the test_netlink module to replay the messages of the service type
+    `type` from the sequence number `seq`, which the module keeps if it has
+    been told to keep the history of the type (history_types).
+
+    Every upcall of a type whose history is kept carries the sequence number
+    of its type, the seq of recv() and recv_batch() (0 for the other types),
+    so a subscriber which finds a gap, or restarts, asks for the next one of
+    the last seq it has handled. The replay ends with the last message of the
+    type when it starts.
+
+    Return (msgs, live, lost), or None if failed, e.g. the module has refused
+    the replay, where msgs are the replayed messages as the tuples of
+    recv_batch(), live the upcalls of any type which have come meanwhile, as
+    the tuples of recv_batch(fd, None), so they end with their service type,
+    and lost the number of the messages from `seq` which are no longer kept
+    (only known if a message has been replayed).
+    """
+    req = struct.pack("=BI", type, seq)
+    if send(fd, req, len(req), TYPE_REPLAY, 0, 0) < 0:
+        return None
+
+    msgs, live = [], []
+    while True:
+        batch = recv_batch(fd, None)
+        if batch is None:
+            return None
+        for msg in batch:
+            if msg[2] == NLMSG_ERROR:
+                return None
+            if not msg[3] & NLM_F_MULTI:
+                live.append(msg)
+            elif msg[2] == NLMSG_DONE:
+                lost = (msgs[0][4] - seq) & 0xFFFFFFFF if msgs else 0
+                return msgs, live, lost
+            else:
+                msgs.append(msg[:-1])
+
+
+def decode_records(type, data, columnar=False):
+    """Decode the fixed-layout records of the service type `type`, as
+    described in test_netlink_schema.h.
+
+    `data` is the payload of a message, or a list of the payloads or of the
+    tuples of recv() and recv_batch(), which are decoded in one call. Return
+    a list of tuples in the order of the fields, or if columnar is True, a
+    dict of the field name to an array.array, e.g.
+
+        cols = decode_records(TYPE_TELEMETRY, sock.recv_batch(TYPE_TELEMETRY), True)
+        values = numpy.frombuffer(cols["value"], dtype=numpy.int64)
+
+    Raise ValueError if there is no schema of the type, or a payload is not a
+    multiple of the record size.
+    """
+    return _netlink.decode_records(type, data, columnar)
+
+
+def schemas():
+    """Return a dict of the service type to (name, record size,
+    ((field, code), ...)), where code is the type code of the array module."""
+    return _netlink.schemas()
+
+
 def close(fd):
     """Return a None."""
     _netlink.close(fd)
@@ -60,8 +256,8 @@ class Netlink(object):
     def __del__(self):
         self.close()
 
-    def recv(self, type=DEFAULT_RECV_TYPE):
-        return recv(self._fd, type)
+    def recv(self, type=DEFAULT_RECV_TYPE, timestamps=False):
+        return recv(self._fd, type, timestamps)
 
     def send(self, data, size, type=DEFAULT_SEND_TYPE, pid=None, group=None):
         if pid is None:
@@ -70,9 +266,133 @@ class Netlink(object):
             group = self.dst_group
         return send(self._fd, data, size, type, pid, group)
 
+    def recv_batch(self, type=DEFAULT_RECV_TYPE, timestamps=False):
+        return recv_batch(self._fd, type, timestamps)
+
+    def send_batch(self, msgs, type=DEFAULT_SEND_TYPE, pid=None, group=None):
+        if pid is None:
+            pid = self.dst_pid
+        if group is None:
+            group = self.dst_group
+        return send_batch(self._fd, msgs, type, pid, group)
+
+    def stats(self, diag=False):
+        return stats(self._fd, diag)
+
+    def cork(self, max_bytes=None, max_msgs=64, delay_us=50):
+        return cork(self._fd, max_bytes, max_msgs, delay_us)
+
+    def flush(self):
+        return flush(self._fd)
+
+    def uncork(self):
+        return uncork(self._fd)
+
+    def busy_poll(self, budget_us=50, adaptive=True):
+        return busy_poll(self._fd, budget_us, adaptive)
+
+    def replay(self, type, seq):
+        return replay(self._fd, type, seq)
+
+    def join_group(self, group):
+        return join_group(self._fd, group)
+
+    def leave_group(self, group):
+        return leave_group(self._fd, group)
+
+    def capture(self, path):
+        return capture(self._fd, path)
+
+    def capture_stop(self):
+        return capture_stop(self._fd)
+
     def close(self):
-        if self._fd != -1:
+        if self._fd >= 0:
             close(self._fd)
+            self._fd = -1
+
+
+class Relay(object):
+    """Fan the messages received by a Netlink out to the local processes.
+
+    The producer receives every message once from the kernel and writes it
+    into the shared memory ring `name` (e.g. "/nlrelay"), which any number of
+    RelayConsumer read. A message larger than `slot_size` less 32 bytes is
+    dropped. A consumer which falls `nslots` messages behind loses the oldest.
+    """
+
+    def __init__(self, sock, name, nslots=4096, slot_size=2048):
+        self.sock = sock
+        self.name = name
+        self._h = _netlink.relay_create(name, nslots, slot_size)
+        if self._h < 0:
+            raise Exception("Failed to create the relay %s" % name)
+
+    def __del__(self):
+        self.close()
+
+    def pump(self, block=True):
+        """Move the messages of the next datagram into the ring.
+
+        Return the number of the messages, or -1 if failed.
+        """
+        return _netlink.relay_pump(self._h, self.sock._fd, block)
+
+    def run(self):
+        """Pump until the socket fails."""
+        while self.pump() >= 0:
+            pass
+
+    def stats(self):
+        return _netlink.relay_stats(self._h)
+
+    def close(self):
+        if self._h >= 0:
+            _netlink.relay_close(self._h)
+            self._h = -1
+
+
+class RelayConsumer(object):
+    """Read the messages of the Relay `name`, from the next one, or from the
+    oldest one still in the ring if `oldest`."""
+
+    def __init__(self, name, oldest=False):
+        self.name = name
+        self._h = _netlink.relay_attach(name, oldest)
+        if self._h < 0:
+            raise Exception("Failed to attach to the relay %s" % name)
+
+    def __del__(self):
+        self.close()
+
+    def read(self, max=64, timeout=None, type=None):
+        """Return a list of (data, size, type, flags, seq, pid) like recv_batch,
+        at most `max` messages, of the service `type` if not None.
+
+        Wait up to `timeout` seconds for a message, for ever if None. Return an
+        empty list if timed out.
+        """
+        return _netlink.relay_read(self._h, max, -1.0 if timeout is None else timeout,
+                                   -1 if type is None else type)
+
+    def stats(self):
+        """Return a dict, in which lag is the number of the messages written
+        but not read yet, and overruns the number of the messages lost because
+        the producer has overwritten them."""
+        return _netlink.relay_stats(self._h)
+
+    @property
+    def lag(self):
+        return self.stats()["lag"]
+
+    @property
+    def overruns(self):
+        return self.stats()["overruns"]
+
+    def close(self):
+        if self._h >= 0:
+            _netlink.relay_close(self._h)
+            self._h = -1
 
 
 if __name__ == "__main__":
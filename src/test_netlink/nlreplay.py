@@ -0,0 +1,162 @@
+# coding: utf-8
+"""Read and replay the captures made by netlink.capture().
+
+The messages are pushed through send_batch: the consecutive messages which
+are due, have the same service type and destination, and fit in a datagram
+are sent together. They are replayed at the original rate, N times faster
+(--speed N), or as fast as possible (--speed 0).
+
+By default only the messages which the captured socket sent are replayed,
+to the destination recorded in the capture, e.g. capture a client of the
+test_netlink module, then replay it against the module:
+
+    python nlreplay.py client.cap --speed 10
+
+Usage: python nlreplay.py FILE [--speed 1] [--direction tx|rx|all]
+                               [--pid PID] [--group GROUP] [--src-pid 0]
+                               [--protocol 30] [--loop 1]
+"""
+from __future__ import division, print_function
+
+import argparse
+import collections
+import mmap
+import os
+import struct
+import time
+
+import netlink
+
+MAGIC = b"NLCAP\x00\x00\x00"
+HEADER = struct.Struct("=8sIIQ")
+RECORD = struct.Struct("=IBBHQIIII")
+
+RX, TX = 0, 1
+
+# The stamp of an upcall with NL_F_TIMESTAMP, before the service data.
+STAMP_SIZE = struct.calcsize("=QI")
+
+# The largest datagram which _netlink.send_batch can send.
+MAX_DATAGRAM = 16 + 60000
+
+Record = collections.namedtuple("Record", "dir type flags time pid group seq data")
+
+
+def align(n):
+    return (n + 7) & ~7
+
+
+def read_capture(path):
+    """Yield the records of a capture in order, as Record, whose time is the
+    CLOCK_REALTIME in ns."""
+    with open(path, "rb") as f:
+        if os.fstat(f.fileno()).st_size == 0:
+            raise ValueError("%s is empty" % path)
+        buf = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    try:
+        magic, version, record_size, _ = HEADER.unpack_from(buf, 0)
+        if magic != MAGIC or version != 1 or record_size != RECORD.size:
+            raise ValueError("%s is not a capture of version 1" % path)
+
+        offset = align(HEADER.size)
+        while offset + RECORD.size <= len(buf):
+            length, dir, type, flags, stamp, pid, group, seq, size = RECORD.unpack_from(buf, offset)
+            # The rest of a capture which was not stopped is zero.
+            if length == 0 or offset + length > len(buf):
+                break
+            start = offset + RECORD.size
+            # Replay the service data without the stamp of the kernel.
+            if flags & netlink.NL_F_TIMESTAMP and size >= STAMP_SIZE:
+                start += STAMP_SIZE
+                size -= STAMP_SIZE
+            yield Record(dir, type, flags, stamp, pid, group, seq, buf[start:start + size])
+            offset += align(length)
+    finally:
+        buf.close()
+
+
+def datagram_size(size):
+    # nlmsghdr + the type byte + the payload, aligned to 4 bytes.
+    return (16 + 1 + size + 3) & ~3
+
+
+def batches(records, speed):
+    """Group the records into (due, type, pid, group, [data, ...]), where due
+    is the offset in seconds from the start of the replay."""
+    batch = None
+    first = None
+    for rec in records:
+        if first is None:
+            first = rec.time
+        due = (rec.time - first) / 1e9 / speed if speed else 0
+        key = (rec.type, rec.pid, rec.group)
+        size = datagram_size(len(rec.data))
+        if (batch and tuple(batch[1:4]) == key and batch[5] + size <= MAX_DATAGRAM
+                and (not speed or due - batch[0] < 1e-4)):
+            batch[4].append(rec.data)
+            batch[5] += size
+            continue
+        if batch:
+            yield batch[:5]
+        batch = [due, rec.type, rec.pid, rec.group, [rec.data], size]
+    if batch:
+        yield batch[:5]
+
+
+def replay(sock, records, speed=1.0, pid=None, group=None):
+    """Send the records through the Netlink `sock`.
+
+    Return (messages, datagrams, failures, seconds, late), where late is the
+    maximal delay in seconds behind the schedule.
+    """
+    msgs = datagrams = failures = 0
+    late = 0.0
+    start = time.time()
+    for due, type, dst_pid, dst_group, items in batches(records, speed):
+        wait = start + due - time.time()
+        if wait > 0:
+            time.sleep(wait)
+        else:
+            late = max(late, -wait)
+
+        ret = sock.send_batch(items, type,
+                              dst_pid if pid is None else pid,
+                              dst_group if group is None else group)
+        if ret < 0:
+            failures += 1
+        else:
+            msgs += len(items)
+        datagrams += 1
+    return msgs, datagrams, failures, time.time() - start, late
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("file")
+    parser.add_argument("--speed", type=float, default=1.0,
+                        help="the factor of the original rate, 0 means as fast as possible")
+    parser.add_argument("--direction", choices=["tx", "rx", "all"], default="tx")
+    parser.add_argument("--pid", type=int, help="replace the recorded destination pid")
+    parser.add_argument("--group", type=int, help="replace the recorded destination groups")
+    parser.add_argument("--src-pid", type=int, default=0, help="the pid of the replaying socket")
+    parser.add_argument("--protocol", type=int, default=netlink.NETLINK_PROTOCOL)
+    parser.add_argument("--loop", type=int, default=1)
+    args = parser.parse_args()
+
+    directions = {"tx": (TX,), "rx": (RX,), "all": (RX, TX)}[args.direction]
+    records = [r for r in read_capture(args.file) if r.dir in directions]
+    if not records:
+        raise SystemExit("No message to replay")
+
+    sock = netlink.Netlink(pid=args.src_pid, group=0, protocol=args.protocol)
+    for _ in range(args.loop):
+        msgs, datagrams, failures, seconds, late = replay(sock, records, args.speed,
+                                                          args.pid, args.group)
+        print("replayed %d messages in %d datagrams (%d failed) in %.3fs, %.0f msgs/s, "
+              "at most %.3fs late" % (msgs, datagrams, failures, seconds,
+                                      msgs / seconds if seconds else 0, late))
+    sock.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -6,60 +6,447 @@
  * Use:
  *   1. Call test_netlink_init to register the Netlink Protocol.
  *   2. Call register_service_handler to register the service type, in order to
- *      receive the data from userspace.
+ *      receive the data from userspace, or register_service_batch_handler to
+ *      receive all the messages of the type in a skb at once. Call
+ *      unregister_service_handler before the handler goes away.
  *   3. Call the unicast or broadcast function to send the data to the userspace
  *      from the kernel.
  *   4. Call test_netlink_exit to cleanup the Netlink.
  *
+ * Every network namespace has its own socket, history and statistics, so the
+ * containers don't share one receive path. The functions without a `net`
+ * argument work in &init_net; a handler finds the namespace of a message with
+ * sock_net(skb->sk). The statistics of a namespace are in /proc/net/test_netlink.
+ *
  */
 
 #include <linux/module.h>
+#include <linux/ratelimit.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/bitmap.h>
+#include <linux/ktime.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <net/sock.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
 #include <linux/netlink.h>
 #include <linux/skbuff.h>
 
 #include "test_netlink.h"
+#include "test_netlink_schema.h"
+
+#define CREATE_TRACE_POINTS
+#include "test_netlink_trace.h"
 
-static struct sock *nl_sk = NULL;
-static nl_recv_msg_t service_msg_handler[256] = {NULL};
+// One of them is set for a handled type, both only while swapping them. They
+// are read under rcu_read_lock() by nl_recv_msg, and set with service_handler_mutex.
+static nl_recv_msg_t __rcu service_msg_handler[256] = {NULL};
+static nl_recv_batch_t __rcu service_batch_handler[256] = {NULL};
+static DEFINE_MUTEX(service_handler_mutex);
+
+static void set_service_handler(nl_recv_msg_t handler, nl_recv_batch_t batch, __u8 type)
+{
+	bool replaced;
+
+	mutex_lock(&service_handler_mutex);
+	replaced = rcu_access_pointer(service_msg_handler[type]) ||
+		rcu_access_pointer(service_batch_handler[type]);
+	// Set the new handler before clearing the other one, so that no message
+	// is dropped while swapping; the message handler wins if both are set.
+	if (batch) {
+		rcu_assign_pointer(service_batch_handler[type], batch);
+		rcu_assign_pointer(service_msg_handler[type], NULL);
+	} else {
+		rcu_assign_pointer(service_msg_handler[type], handler);
+		rcu_assign_pointer(service_batch_handler[type], NULL);
+	}
+	mutex_unlock(&service_handler_mutex);
+
+	// The old handler may run until the readers have left.
+	if (replaced)
+		synchronize_rcu();
+}
 
 void register_service_handler(nl_recv_msg_t handler, __u8 type)
 {
-	rcu_assign_pointer(service_msg_handler[type], handler);
+	set_service_handler(handler, NULL, type);
 }
 EXPORT_SYMBOL(register_service_handler);
 
+void register_service_batch_handler(nl_recv_batch_t handler, __u8 type)
+{
+	set_service_handler(NULL, handler, type);
+}
+EXPORT_SYMBOL(register_service_batch_handler);
+
+// Wait until the handler of the type is no longer running, e.g. before the
+// module which owns it is unloaded.
+void unregister_service_handler(__u8 type)
+{
+	set_service_handler(NULL, NULL, type);
+}
+EXPORT_SYMBOL(unregister_service_handler);
 
-// upcall_service_to_pid_or_group:
-//     Upcall message to the userspace through unicast or broadcast/multicast.
+
+// The userspace joins the groups above 32 with NETLINK_ADD_MEMBERSHIP, as the
+// mask of bind() only covers the first 32.
+static unsigned int groups = 32;
+module_param(groups, uint, 0444);
+MODULE_PARM_DESC(groups, "The number of the multicast groups of the protocol, 32 at least");
+
+
+/// -----------------------------------------------------------------------
+/// Time stamps
+
+static unsigned short timestamp_types[256];
+static int ntimestamp_types = 0;
+module_param_array(timestamp_types, ushort, &ntimestamp_types, 0444);
+MODULE_PARM_DESC(timestamp_types, "The service types whose upcalls are stamped from the loading");
+
+// The types whose upcalls carry a struct nl_stamp.
+static DECLARE_BITMAP(service_timestamps, 256);
+
+void set_service_timestamp(__u8 type, bool on)
+{
+	if (on)
+		set_bit(type, service_timestamps);
+	else
+		clear_bit(type, service_timestamps);
+}
+EXPORT_SYMBOL(set_service_timestamp);
+
+
+/// -----------------------------------------------------------------------
+/// History
 //
+// If the history of a service type is enabled, every upcall of the type
+// carries the next sequence number of the type in nlmsg_seq, and keeps a copy
+// of the message, up to `msgs` messages and `bytes` bytes of data, the oldest
+// being dropped first. The upcalls of the other types carry 0 and cost nothing.
+// A subscriber which has lost messages, e.g. after a restart or an overrun of
+// its socket, sends a NL_TYPE_REPLAY message with the type and the first
+// sequence number it wants, and gets the messages still kept, up to the last
+// one when the replay starts, as a multipart dump: NLMSG_MIN_TYPE messages with
+// NLM_F_MULTI, then NLMSG_DONE. The dump is paced by the reads of the
+// subscriber, so it never overruns its socket, and the producers only wait for
+// the copy of a skb.
+
+static unsigned short history_types[256];
+static int nhistory_types = 0;
+module_param_array(history_types, ushort, &nhistory_types, 0444);
+MODULE_PARM_DESC(history_types, "The service types whose history is kept from the loading");
+
+static unsigned int history_msgs = 1024;
+module_param(history_msgs, uint, 0444);
+MODULE_PARM_DESC(history_msgs, "The maximum messages in the history of a type of history_types, 0 means no limit");
+
+static unsigned int history_bytes = 0;
+module_param(history_bytes, uint, 0444);
+MODULE_PARM_DESC(history_bytes, "The maximum bytes in the history of a type of history_types, 0 means no limit");
+
+struct service_history_entry {
+	struct list_head list;
+	__u32 seq;
+	size_t size;
+	unsigned char data[0];
+};
+
+struct service_history {
+	spinlock_t lock;	// Protect the following.
+	__u32 seq;		// The last sequence number of the type.
+	bool enabled;
+	unsigned int max_msgs;
+	size_t max_bytes;
+	struct list_head entries;	// The oldest first.
+	unsigned int count;
+	size_t bytes;
+};
+
+// The statistics of a namespace.
+struct test_netlink_stats {
+	atomic_long_t upcalls;		// The messages sent to the userspace.
+	atomic_long_t upcall_errors;	// The upcalls which failed.
+	atomic_long_t received;		// The messages received from the userspace.
+	atomic_long_t unhandled;	// The received messages without a handler.
+	atomic_long_t replays;		// The replays which have been started.
+};
+
+// The state of a network namespace, see test_netlink_net_init.
+struct test_netlink_net {
+	struct sock *sk;
+	struct test_netlink_stats stats;
+	struct service_history history[256];
+};
+
+static int test_netlink_net_id __read_mostly;
+
+static inline struct test_netlink_net *test_netlink_pernet(struct net *net)
+{
+	return net_generic(net, test_netlink_net_id);
+}
+
+
+// Drop the oldest messages while the history is over its limits, with the lock.
+static void service_history_trim(struct service_history *h, struct list_head *freed)
+{
+	struct service_history_entry *e;
+
+	while (h->count && ((h->max_msgs && h->count > h->max_msgs)
+				|| (h->max_bytes && h->bytes > h->max_bytes))) {
+		e = list_first_entry(&h->entries, struct service_history_entry, list);
+		list_move_tail(&e->list, freed);
+		h->count--;
+		h->bytes -= e->size;
+	}
+}
+
+static void service_history_free(struct list_head *freed)
+{
+	struct service_history_entry *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, freed, list) {
+		list_del(&e->list);
+		kfree(e);
+	}
+}
+
+// set_service_history_net:
+//     Keep the last `msgs` messages and at most `bytes` bytes of data of the
+//     service type `type` in the namespace `net`, 0 means no limit. If both are
+//     0, stop keeping it and drop what is kept.
+void set_service_history_net(struct net *net, __u8 type, unsigned int msgs, size_t bytes)
+{
+	struct service_history *h = &test_netlink_pernet(net)->history[type];
+	unsigned long flags;
+	LIST_HEAD(freed);
+
+	spin_lock_irqsave(&h->lock, flags);
+	h->enabled = msgs || bytes;
+	h->max_msgs = msgs;
+	h->max_bytes = bytes;
+	if (!h->enabled) {
+		list_splice_init(&h->entries, &freed);
+		h->count = 0;
+		h->bytes = 0;
+	} else {
+		service_history_trim(h, &freed);
+	}
+	spin_unlock_irqrestore(&h->lock, flags);
+
+	service_history_free(&freed);
+}
+EXPORT_SYMBOL(set_service_history_net);
+
+void set_service_history(__u8 type, unsigned int msgs, size_t bytes)
+{
+	set_service_history_net(&init_net, type, msgs, bytes);
+}
+EXPORT_SYMBOL(set_service_history);
+
+// If the history of `type` is enabled, keep a copy of the message and return
+// its sequence number, or return 0.
+static __u32 service_history_add(struct test_netlink_net *tn, __u8 type, void *data, size_t size)
+{
+	struct service_history *h = &tn->history[type];
+	struct service_history_entry *e;
+	unsigned long flags;
+	LIST_HEAD(freed);
+	__u32 seq = 0;
+
+	if (!ACCESS_ONCE(h->enabled))
+		return 0;
+
+	e = kmalloc(sizeof(*e) + size, GFP_ATOMIC);
+	if (e) {
+		e->size = size;
+		memcpy(e->data, data, size);
+	}
+
+	// The sequence number is taken with the lock, to keep the entries in order.
+	// A message which cannot be kept still takes one, so the gap shows it.
+	spin_lock_irqsave(&h->lock, flags);
+	if (h->enabled)
+		seq = ++h->seq;
+	if (e && h->enabled) {
+		e->seq = seq;
+		list_add_tail(&e->list, &h->entries);
+		h->count++;
+		h->bytes += size;
+		service_history_trim(h, &freed);
+		e = NULL;
+	}
+	spin_unlock_irqrestore(&h->lock, flags);
+
+	kfree(e);
+	service_history_free(&freed);
+	return seq;
+}
+
+// The dump of a replay, whose state is taken from the request at the first
+// call and kept in cb->args:
+//     args[0] the service type,
+//     args[1] the sequence number of the last message sent,
+//     args[2] the last sequence number of the replay, that's, of the type when
+//             the replay starts, so that the producers can't keep it going,
+//     args[3] the entry of args[1], NULL before the first message,
+//     args[4] set once the state is taken.
+// The entries are dropped from the oldest, so the entry of args[3] is still
+// kept, and the next call resumes from it, while the oldest entry is not newer.
+static int service_history_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nl_rec_replay *req;
+	struct service_history *h;
+	struct service_history_entry *e;
+	struct list_head *pos;
+	struct nlmsghdr *nlh;
+	unsigned char *buffer;
+	unsigned long flags;
+	__u32 next, end;
+	__u8 type;
+
+	if (!cb->args[4]) {
+		// After the byte of the service type, checked by service_history_replay.
+		req = (struct nl_rec_replay *)((unsigned char *)nlmsg_data(cb->nlh) + 1);
+		cb->args[0] = req->type;
+		cb->args[1] = (__u32)(req->seq - 1);
+		cb->args[3] = 0;
+	}
+	type = (__u8)cb->args[0];
+	next = (__u32)cb->args[1] + 1;
+	// The request came from a socket of the namespace of the dump.
+	h = &test_netlink_pernet(sock_net(cb->skb->sk))->history[type];
+
+	spin_lock_irqsave(&h->lock, flags);
+	if (!cb->args[4]) {
+		cb->args[2] = h->seq;
+		cb->args[4] = 1;
+	}
+	end = (__u32)cb->args[2];
+
+	pos = h->entries.next;
+	if (pos == &h->entries || (__s32)(list_entry(pos, struct service_history_entry, list)->seq - next) >= 0) {
+		// Nothing is kept, or everything kept is wanted.
+	} else if (cb->args[3]) {
+		// Resume after the last entry sent, which is still kept.
+		pos = ((struct service_history_entry *)cb->args[3])->list.next;
+	} else {
+		// Search from the newest, as a subscriber usually asks for the recent ones.
+		pos = h->entries.prev;
+		while (pos != &h->entries &&
+				(__s32)(list_entry(pos, struct service_history_entry, list)->seq - next) >= 0)
+			pos = pos->prev;
+		pos = pos->next;
+	}
+
+	for (; pos != &h->entries; pos = pos->next) {
+		e = list_entry(pos, struct service_history_entry, list);
+		if ((__s32)(e->seq - end) > 0)
+			break;
+
+		nlh = nlmsg_put(skb, NETLINK_CB(cb->skb).pid, e->seq, NLMSG_MIN_TYPE,
+				e->size + 1, NLM_F_MULTI);
+		if (!nlh)
+			break;
+		buffer = nlmsg_data(nlh);
+		*buffer = type;
+		memcpy(buffer+1, e->data, e->size);
+		cb->args[1] = e->seq;
+		cb->args[3] = (long)e;
+	}
+	spin_unlock_irqrestore(&h->lock, flags);
+
+	// 0 once nothing is left up to `end`, which ends the dump with NLMSG_DONE.
+	return skb->len;
+}
+
+static void service_history_replay(struct test_netlink_net *tn, struct sk_buff *skb,
+		struct nlmsghdr *nlh, void *data, size_t size)
+{
+	struct nl_rec_replay *req = data;
+	/*
+	// 2.6.32 - 3.2 kernel
+	// err = netlink_dump_start(tn->sk, skb, nlh, service_history_dump, NULL, 0);
+	*/
+	// 3.3 kernel and above
+	struct netlink_dump_control c = {
+		.dump = service_history_dump,
+	};
+	int err;
+
+	// The subscriber waits for the end of the dump, so it gets a NLMSG_ERROR
+	// if the dump is not started.
+	if (size < sizeof(*req)) {
+		printk_ratelimited(KERN_ERR "Netlink replay request is too short: %zu\n", size);
+		netlink_ack(skb, nlh, -EINVAL);
+		return;
+	}
+
+	// netlink_dump_start returns -EINTR once the dump is started, or e.g.
+	// -EBUSY while another dump of the socket is running.
+	err = netlink_dump_start(tn->sk, skb, nlh, &c);
+	if (err != -EINTR) {
+		printk_ratelimited(KERN_ERR "Failed to replay the service type %u: %d\n", req->type, err);
+		netlink_ack(skb, nlh, err);
+		return;
+	}
+	atomic_long_inc(&tn->stats.replays);
+}
+
+
+// upcall_service_to_pid_or_group_net:
+//     Upcall message to the userspace of the namespace `net` through unicast or
+//     broadcast/multicast.
+//
+// @net:  the network namespace of the receiver.
 // @data: the data which is sent to the userspace.
 // @size: the size of `data`.
 // @type: the type of the service.
-// @pg:   the pid or group of the receiver, according to `group`.
+// @pg:   the pid or group of the receiver, according to `group`. A group is
+//        a number from 1 to the `groups` module parameter, not a mask.
 // @group: If true, broadcast the message; or, unicast.
-int upcall_service_to_pid_or_group(void *data, size_t size, __u8 type, __u32 pg, bool group)
+int upcall_service_to_pid_or_group_net(struct net *net, void *data, size_t size, __u8 type,
+		__u32 pg, bool group)
 {
+	struct test_netlink_net *tn = test_netlink_pernet(net);
 	struct sk_buff *skb_out;
 	struct nlmsghdr *nlh;
 	unsigned char *buffer;
+	struct nl_stamp stamp;
+	size_t stamp_len = 0;
+	__u32 seq;
+	int err;
+
+	if (test_bit(type, service_timestamps)) {
+		// ktime_get_ns() for 3.17 kernel and above
+		stamp.ns = ktime_to_ns(ktime_get());
+		stamp.cpu = raw_smp_processor_id();
+		stamp_len = sizeof(stamp);
+	}
 
+	seq = service_history_add(tn, type, data, size);
 	size += 1;	// Add a byte for `type`
 
-	skb_out = nlmsg_new(size, GFP_ATOMIC);
+	skb_out = nlmsg_new(size + stamp_len, GFP_ATOMIC);
 	if(!skb_out) {
-		printk(KERN_ERR "Failed to allocate a new sk_buff\n");
+		atomic_long_inc(&tn->stats.upcall_errors);
+		printk_ratelimited(KERN_ERR "Failed to allocate a new sk_buff\n");
 		return -1;
 	}
+	trace_nl_skb_alloc(type, size - 1, pg, group);
 
 	/*
 	* struct nlmsghdr *
 	* __nlmsg_put(struct sk_buff *skb, u32 portid, u32 seq, int type, int len, int flags);
 	*/
-	nlh = nlmsg_put(skb_out, 0, 0, NLMSG_DONE, size, 0);
+	nlh = nlmsg_put(skb_out, 0, seq, NLMSG_DONE, size + stamp_len, stamp_len ? NL_F_TIMESTAMP : 0);
 	buffer = (unsigned char *)nlmsg_data(nlh);
 	*buffer = type;
-	memcpy(buffer+1, data, size-1);
+	memcpy(buffer+1, &stamp, stamp_len);
+	memcpy(buffer+1+stamp_len, data, size-1);
 
 
 	/*
@@ -77,21 +464,38 @@ int upcall_service_to_pid_or_group(void *data, size_t size, __u8 type, __u32 pg,
 		 * netlink_broadcast(struct sock *ssk, struct sk_buff *skb, __u32 portid, __u32 group, gfp_t allocation);
 		 * 向Group为group、并排除PortID为portid的所有 Netlink Socket 广播此消息。
 		 */
-		if (netlink_broadcast(nl_sk, skb_out, 0, pg, GFP_ATOMIC) < 0) {
-			printk(KERN_ERR "Error while sending a msg to userspace\n");
+		trace_nl_send_start(type, size - 1, pg, true);
+		err = netlink_broadcast(tn->sk, skb_out, 0, pg, GFP_ATOMIC);
+		trace_nl_send_end(type, size - 1, pg, true, err);
+		if (err < 0) {
+			atomic_long_inc(&tn->stats.upcall_errors);
+			printk_ratelimited(KERN_ERR "Error while sending a msg to userspace\n");
 			return -1;
 		}
 	}
 	else {  // 单播
 		NETLINK_CB(skb_out).dst_group = 0;  /* not in multicast group */
-		if(nlmsg_unicast(nl_sk, skb_out, pg) < 0) {
-			printk(KERN_INFO "Error while sending a msg to userspace\n");
+		trace_nl_send_start(type, size - 1, pg, false);
+		err = nlmsg_unicast(tn->sk, skb_out, pg);
+		trace_nl_send_end(type, size - 1, pg, false, err);
+		if(err < 0) {
+			atomic_long_inc(&tn->stats.upcall_errors);
+			printk_ratelimited(KERN_INFO "Error while sending a msg to userspace\n");
 			return -1;
 		}
 	}
 
+	atomic_long_inc(&tn->stats.upcalls);
 	return 0;
 }
+EXPORT_SYMBOL(upcall_service_to_pid_or_group_net);
+
+// upcall_service_to_pid_or_group:
+//     The same as upcall_service_to_pid_or_group_net in &init_net.
+int upcall_service_to_pid_or_group(void *data, size_t size, __u8 type, __u32 pg, bool group)
+{
+	return upcall_service_to_pid_or_group_net(&init_net, data, size, type, pg, group);
+}
 EXPORT_SYMBOL(upcall_service_to_pid_or_group);
 
 
@@ -157,25 +561,142 @@ EXPORT_SYMBOL(broadcast_service);
 
 /// -----------------------------------------------------------------------
 
+// Dispatch a message to the handler of its service type, with rcu_read_lock().
+// `data` starts with the byte of the type.
 static void msg_handler_default(struct sk_buff *skb, struct nlmsghdr *nlh, void *data, size_t size)
 {
 	unsigned char *buffer = (unsigned char *)data;
-
-	if (size == 0) {
-		printk(KERN_ERR "No Netlink Message\n");
+	struct nl_msg_entry entry;
+	nl_recv_msg_t handler;
+	nl_recv_batch_t batch;
+
+	trace_nl_handler_entry(*buffer, size-1, nlh->nlmsg_pid);
+	handler = rcu_dereference(service_msg_handler[*buffer]);
+	batch = rcu_dereference(service_batch_handler[*buffer]);
+	if (handler) {
+		handler(skb, nlh, buffer+1, size-1);
+		trace_nl_handler_exit(*buffer, size-1, nlh->nlmsg_pid, true);
+	} else if (batch) {
+		entry.data = buffer+1;
+		entry.size = size-1;
+		entry.nlh = nlh;
+		batch(skb, &entry, 1);
+		trace_nl_handler_exit(*buffer, size-1, nlh->nlmsg_pid, true);
+	} else {
+		trace_nl_handler_exit(*buffer, size-1, nlh->nlmsg_pid, false);
+		atomic_long_inc(&test_netlink_pernet(sock_net(skb->sk))->stats.unhandled);
+		printk_ratelimited(KERN_ERR "Netlink Protocol(%d) received a unknown service message: ServiceType(%d)\n", NETLINK_DEFAULT, *buffer);
 	}
+}
 
-	if (service_msg_handler[*buffer]) {
-		service_msg_handler[*buffer](skb, nlh, buffer+1, size-1);
-	} else {
-		printk(KERN_ERR "Netlink Protocol(%d) received a unknown service message: ServiceType(%d)\n", NETLINK_DEFAULT, *buffer);
+// Dispatch the messages of a type to its batch handler in one call, with
+// rcu_read_lock(). If the handler has been replaced meanwhile, fall back to
+// the dispatch of every message.
+static void batch_handler_default(struct sk_buff *skb, __u8 type, struct nl_msg_entry *msgs, unsigned int n)
+{
+	nl_recv_batch_t batch;
+	size_t size = 0;
+	unsigned int i;
+
+	batch = rcu_dereference(service_batch_handler[type]);
+	if (!batch) {
+		for (i = 0; i < n; i++)
+			msg_handler_default(skb, msgs[i].nlh, nlmsg_data(msgs[i].nlh), msgs[i].size+1);
+		return;
 	}
+
+	for (i = 0; i < n; i++)
+		size += msgs[i].size;
+	trace_nl_handler_entry(type, size, msgs[0].nlh->nlmsg_pid);
+	batch(skb, msgs, n);
+	trace_nl_handler_exit(type, size, msgs[0].nlh->nlmsg_pid, true);
 }
 
+#define NL_RECV_STACK_MSGS	16
+
+struct nl_pending_msg {
+	struct nl_msg_entry entry;
+	__u8 type;
+	bool done;
+};
+
+// Handle every message of the skb, which came to the socket of the namespace
+// of skb->sk. The messages of a type with a batch handler are delivered
+// together after the others, in their order.
 static void nl_recv_msg(struct sk_buff *skb)
 {
-	struct nlmsghdr *nlh = (struct nlmsghdr*)skb->data;
-	msg_handler_default(skb, nlh, nlmsg_data(nlh), nlmsg_len(nlh));
+	struct test_netlink_net *tn = test_netlink_pernet(sock_net(skb->sk));
+	struct nl_pending_msg stack_pending[NL_RECV_STACK_MSGS], *pending = stack_pending;
+	struct nl_msg_entry stack_batch[NL_RECV_STACK_MSGS], *batch = stack_batch;
+	struct nlmsghdr *nlh;
+	unsigned char *buffer;
+	unsigned int n = 0, npending = 0, i, j, k;
+	int len;
+
+	for (nlh = nlmsg_hdr(skb), len = skb->len; nlmsg_ok(nlh, len); nlh = nlmsg_next(nlh, &len))
+		n++;
+	if (n > NL_RECV_STACK_MSGS) {
+		pending = kmalloc(n * sizeof(*pending), GFP_ATOMIC);
+		batch = kmalloc(n * sizeof(*batch), GFP_ATOMIC);
+		if (!pending || !batch) {
+			// Deliver the messages one by one.
+			kfree(pending);
+			kfree(batch);
+			pending = NULL;
+			batch = NULL;
+		}
+	}
+
+	for (nlh = nlmsg_hdr(skb), len = skb->len; nlmsg_ok(nlh, len); nlh = nlmsg_next(nlh, &len)) {
+		if (nlmsg_len(nlh) < 1) {
+			printk_ratelimited(KERN_ERR "No Netlink Message\n");
+			continue;
+		}
+		buffer = nlmsg_data(nlh);
+		atomic_long_inc(&tn->stats.received);
+
+		// The replay starts a dump, which may sleep, so it is not a handler.
+		if (*buffer == NL_TYPE_REPLAY) {
+			trace_nl_handler_entry(*buffer, nlmsg_len(nlh)-1, nlh->nlmsg_pid);
+			service_history_replay(tn, skb, nlh, buffer+1, nlmsg_len(nlh)-1);
+			trace_nl_handler_exit(*buffer, nlmsg_len(nlh)-1, nlh->nlmsg_pid, true);
+			continue;
+		}
+
+		if (pending && rcu_access_pointer(service_batch_handler[*buffer])) {
+			pending[npending].entry.data = buffer+1;
+			pending[npending].entry.size = nlmsg_len(nlh)-1;
+			pending[npending].entry.nlh = nlh;
+			pending[npending].type = *buffer;
+			pending[npending].done = false;
+			npending++;
+			continue;
+		}
+
+		rcu_read_lock();
+		msg_handler_default(skb, nlh, buffer, nlmsg_len(nlh));
+		rcu_read_unlock();
+	}
+
+	// Gather the messages of every type, in the order of their first message.
+	for (i = 0; i < npending; i++) {
+		if (pending[i].done)
+			continue;
+		for (j = i, k = 0; j < npending; j++) {
+			if (!pending[j].done && pending[j].type == pending[i].type) {
+				batch[k++] = pending[j].entry;
+				pending[j].done = true;
+			}
+		}
+		rcu_read_lock();
+		batch_handler_default(skb, pending[i].type, batch, k);
+		rcu_read_unlock();
+	}
+
+	if (pending != stack_pending) {
+		kfree(pending);
+		kfree(batch);
+	}
 }
 
 static void default_service_handler(struct sk_buff *skb, struct nlmsghdr *nlh, void *data, size_t size)
@@ -183,16 +704,52 @@ static void default_service_handler(struct sk_buff *skb, struct nlmsghdr *nlh, v
 	printk(KERN_INFO "Recived a default service message\n");
 }
 
-int test_netlink_init(void)
+/// -----------------------------------------------------------------------
+/// Network namespaces
+
+static int test_netlink_stats_show(struct seq_file *seq, void *v)
 {
-	pr_info("Loading Netlink Module\n");
+	struct test_netlink_net *tn = test_netlink_pernet(seq->private);
+
+	seq_printf(seq, "upcalls: %ld\n", atomic_long_read(&tn->stats.upcalls));
+	seq_printf(seq, "upcall_errors: %ld\n", atomic_long_read(&tn->stats.upcall_errors));
+	seq_printf(seq, "received: %ld\n", atomic_long_read(&tn->stats.received));
+	seq_printf(seq, "unhandled: %ld\n", atomic_long_read(&tn->stats.unhandled));
+	seq_printf(seq, "replays: %ld\n", atomic_long_read(&tn->stats.replays));
+	return 0;
+}
+
+static int test_netlink_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open_net(inode, file, test_netlink_stats_show);
+}
+
+static const struct file_operations test_netlink_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = test_netlink_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release_net,
+};
+
+// Create the socket of a namespace, which has been zeroed by the pernet core.
+static int __net_init test_netlink_net_init(struct net *net)
+{
+	struct test_netlink_net *tn = test_netlink_pernet(net);
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		spin_lock_init(&tn->history[i].lock);
+		INIT_LIST_HEAD(&tn->history[i].entries);
+	}
 
 	/*
 	// 对于不同版本的Linux内核， NETLINK接口有所变化， 下面供参考
 
 	// Args:
-	//      net:   &init_net
+	//      net:   the namespace of the socket
 	//      unit:  User-defined Protocol Type
+	//      groups: the number of the multicast groups, 32 at least
 	//      input: the callback function when received the data from the userspace.
 
 	// 3.8 kernel and above
@@ -222,8 +779,8 @@ int test_netlink_init(void)
 
 
 	// Linux Kernel from 2.6.32 - 3.5
-	nl_sk = netlink_kernel_create(&init_net, NETLINK_DEFAULT, 0, nl_recv_msg, NULL, THIS_MODULE);
-	if(!nl_sk) {
+	tn->sk = netlink_kernel_create(net, NETLINK_DEFAULT, groups, nl_recv_msg, NULL, THIS_MODULE);
+	if(!tn->sk) {
 		printk(KERN_ALERT "Failed to create socket.\n");
 		return -10;
 	}
@@ -231,24 +788,69 @@ int test_netlink_init(void)
 	/*
 	//This is for 3.8 kernels and above.
 	struct netlink_kernel_cfg cfg = {
+		.groups = groups,
 		.input = nl_recv_msg,
 	};
-	nl_sk = netlink_kernel_create(&init_net, NETLINK_DEFAULT, &cfg);
-	if(!nl_sk) {
+	tn->sk = netlink_kernel_create(net, NETLINK_DEFAULT, &cfg);
+	if(!tn->sk) {
 		printk(KERN_ALERT "Error creating socket.\n");
 		return -10;
 	}
 	*/
 
+	// For kernel 3.9 below, use proc_net_fops_create(net, "test_netlink", 0444, &test_netlink_stats_fops)
+	if (!proc_create("test_netlink", 0444, net->proc_net, &test_netlink_stats_fops))
+		printk(KERN_WARNING "Failed to create /proc/net/test_netlink\n");
+
+	for (i = 0; i < nhistory_types; i++)
+		set_service_history_net(net, (__u8)history_types[i], history_msgs, history_bytes);
+
+	return 0;
+}
+
+static void __net_exit test_netlink_net_exit(struct net *net)
+{
+	struct test_netlink_net *tn = test_netlink_pernet(net);
+	int i;
+
+	// For kernel 3.9 below, use proc_net_remove(net, "test_netlink")
+	remove_proc_entry("test_netlink", net->proc_net);
+	netlink_kernel_release(tn->sk);
+	for (i = 0; i < 256; i++)
+		set_service_history_net(net, (__u8)i, 0, 0);
+}
+
+static struct pernet_operations test_netlink_net_ops = {
+	.init = test_netlink_net_init,
+	.exit = test_netlink_net_exit,
+	.id   = &test_netlink_net_id,
+	.size = sizeof(struct test_netlink_net),
+};
+
+int test_netlink_init(void)
+{
+	int err, i;
+
+	pr_info("Loading Netlink Module\n");
+
+	// The handlers are shared by the namespaces, so register them first.
 	register_service_handler(default_service_handler, DEFAULT_RECV_TYPE);
+	for (i = 0; i < ntimestamp_types; i++)
+		set_service_timestamp((__u8)timestamp_types[i], true);
+
+	// Call test_netlink_net_init for every existing namespace and the new ones.
+	err = register_pernet_subsys(&test_netlink_net_ops);
+	if (err) {
+		unregister_service_handler(DEFAULT_RECV_TYPE);
+		return err;
+	}
 
 	return 0;
 }
 
 void  test_netlink_exit(void) {
 	printk(KERN_INFO "Unloading Netlink Module\n");
-	if (nl_sk)
-		netlink_kernel_release(nl_sk);
+	unregister_pernet_subsys(&test_netlink_net_ops);
 }
 
 module_init(test_netlink_init);
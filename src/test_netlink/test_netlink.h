@@ -4,6 +4,7 @@
 
 #include <linux/skbuff.h>
 #include <linux/netlink.h>
+#include <net/net_namespace.h>
 
 #define NETLINK_DEFAULT 30
 
@@ -14,9 +15,37 @@
 
 typedef void (*nl_recv_msg_t)(struct sk_buff *skb, struct nlmsghdr *nlh, void *data, size_t size);
 
+// A message of a batch: the service data, without the byte of the type.
+struct nl_msg_entry {
+	void *data;
+	size_t size;
+	struct nlmsghdr *nlh;
+};
+typedef void (*nl_recv_batch_t)(struct sk_buff *skb, struct nl_msg_entry *msgs, unsigned int n);
+
+// The handlers are called under rcu_read_lock(), so they must not sleep. A
+// handler may be replaced at any time; once unregister_service_handler()
+// returns, the old one is no longer running. The handlers serve every network
+// namespace, the one of a message is sock_net(skb->sk).
 extern void register_service_handler(nl_recv_msg_t handler, __u8 type);
+// The handler gets all the messages of the type in a received skb in one call.
+extern void register_service_batch_handler(nl_recv_batch_t handler, __u8 type);
+extern void unregister_service_handler(__u8 type);
+
+// Keep the last `msgs` messages and at most `bytes` bytes of the service type
+// `type` for the replays, 0 means no limit; both 0 stop keeping them.
+extern void set_service_history(__u8 type, unsigned int msgs, size_t bytes);
+extern void set_service_history_net(struct net *net, __u8 type, unsigned int msgs, size_t bytes);
+
+// Stamp the upcalls of the service type `type` with the CPU and the time, see
+// struct nl_stamp in test_netlink_schema.h; the other types don't carry it.
+extern void set_service_timestamp(__u8 type, bool on);
+
+// The basic function, which upcalls to the userspace of the namespace `net`.
+extern int upcall_service_to_pid_or_group_net(struct net *net, void *data, size_t size, __u8 type,
+		__u32 pg, bool group);
 
-// The basic function
+// The functions below upcall to the userspace of &init_net.
 extern int upcall_service_to_pid_or_group(void *data, size_t size, __u8 type, __u32 pg, bool group);
 
 // The following is auxiliary functions based on `upcall_service_to_pid_or_group`.
@@ -35,7 +64,7 @@ extern int unicast_service_to_pid(void *data, size_t size, __u8 type, __u32 pid)
 extern int unicast_service(void *data, size_t size, __u8 type);
 
 // Broadcast. Must have a service type.
-extern int broadcast_servie_to_group(void *data, size_t size, __u8 type, __u32 group);
+extern int broadcast_service_to_group(void *data, size_t size, __u8 type, __u32 group);
 extern int broadcast_service(void *data, size_t size, __u8 type);
 
 
@@ -0,0 +1,404 @@
+/*
+ * Load generator for the upcall path of test_netlink.
+ *
+ * Start one kthread per CPU (or `threads` of them), each calling
+ * unicast_service_to_pid or broadcast_service_to_group at a target rate, and
+ * record the achieved rate, the failures and a histogram of the latency of
+ * every call.
+ *
+ * Use:
+ *   1. Load test_netlink.ko, then this module with the wanted parameters, e.g.
+ *        insmod test_netlink_loadgen.ko rate=100000 size_min=64 size_max=512 \
+ *               types=0,1,2 broadcast=1 dest=1
+ *   2. Start a userspace consumer.
+ *   3. echo 1 > /sys/kernel/debug/test_netlink_loadgen/run   to start,
+ *      echo 0 > /sys/kernel/debug/test_netlink_loadgen/run   to stop.
+ *      The parameters in /sys/module/test_netlink_loadgen/parameters may be
+ *      changed while stopped, and take effect at the next start.
+ *   4. cat /sys/kernel/debug/test_netlink_loadgen/stats
+ *
+ * Like test_netlink, it uses the kernel API of 2.6.36 - 3.5.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/delay.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/log2.h>
+
+#include "test_netlink.h"
+
+#define LOADGEN_MAX_TYPES	16
+#define LOADGEN_LAT_BUCKETS	32	// log2 buckets of the latency in ns
+
+static unsigned int threads = 0;
+module_param(threads, uint, 0644);
+MODULE_PARM_DESC(threads, "The number of kthreads, 0 means one per online CPU");
+
+static unsigned int rate = 0;
+module_param(rate, uint, 0644);
+MODULE_PARM_DESC(rate, "The target calls per second of every kthread, 0 means unlimited");
+
+static unsigned int size_min = 64;
+module_param(size_min, uint, 0644);
+MODULE_PARM_DESC(size_min, "The minimum size of a message");
+
+static unsigned int size_max = 64;
+module_param(size_max, uint, 0644);
+MODULE_PARM_DESC(size_max, "The maximum size of a message, sizes are uniformly distributed");
+
+static unsigned short types[LOADGEN_MAX_TYPES] = {DEFAULT_SEND_TYPE};
+static int ntypes = 1;
+module_param_array(types, ushort, &ntypes, 0644);
+MODULE_PARM_DESC(types, "The service types to upcall, chosen at random for every message");
+
+static bool broadcast = false;
+module_param(broadcast, bool, 0644);
+MODULE_PARM_DESC(broadcast, "Broadcast to the group `dest` instead of unicasting to the pid `dest`");
+
+static unsigned int dest = DEFAULT_DEST_PORTID;
+module_param(dest, uint, 0644);
+MODULE_PARM_DESC(dest, "The destination pid, or group if broadcast");
+
+// The parameters are copied at start, so that they may be changed while running.
+struct loadgen_config {
+	u64 interval;		// ns between two calls, 0 means unlimited
+	unsigned int size_min;
+	unsigned int size_max;
+	__u8 types[LOADGEN_MAX_TYPES];
+	int ntypes;
+	bool broadcast;
+	__u32 dest;
+};
+
+struct loadgen_stats {
+	u64 calls;
+	u64 failures;
+	u64 bytes;
+	u64 latency[LOADGEN_LAT_BUCKETS];
+};
+
+struct loadgen_thread {
+	struct task_struct *task;
+	struct loadgen_stats stats;
+	u64 start_ns;
+	u64 stop_ns;
+	unsigned char *buffer;
+};
+
+static DEFINE_MUTEX(loadgen_lock);	// Protect the following.
+static struct loadgen_config loadgen_cfg;
+static struct loadgen_thread *loadgen_threads;
+static unsigned int loadgen_nthreads;
+static bool loadgen_running;
+static struct dentry *loadgen_dir;
+
+
+static inline u64 loadgen_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static int loadgen_fn(void *arg)
+{
+	struct loadgen_thread *t = arg;
+	const struct loadgen_config *cfg = &loadgen_cfg;
+	u64 next, begin, elapsed;
+	size_t size;
+	__u8 type;
+	int err;
+
+	t->start_ns = next = loadgen_now();
+	while (!kthread_should_stop()) {
+		if (cfg->interval) {
+			next += cfg->interval;
+			while (loadgen_now() < next && !kthread_should_stop()) {
+				if (next - loadgen_now() > 20 * NSEC_PER_USEC)
+					usleep_range(10, 20);
+				else
+					cpu_relax();
+			}
+		}
+
+		size = cfg->size_min;
+		if (cfg->size_max > cfg->size_min)
+			size += random32() % (cfg->size_max - cfg->size_min + 1);
+		type = cfg->types[cfg->ntypes > 1 ? random32() % cfg->ntypes : 0];
+
+		begin = loadgen_now();
+		if (cfg->broadcast)
+			err = broadcast_service_to_group(t->buffer, size, type, cfg->dest);
+		else
+			err = unicast_service_to_pid(t->buffer, size, type, cfg->dest);
+		elapsed = loadgen_now() - begin;
+
+		t->stats.calls++;
+		if (err < 0)
+			t->stats.failures++;
+		else
+			t->stats.bytes += size;
+		t->stats.latency[min_t(int, elapsed ? ilog2(elapsed) : 0, LOADGEN_LAT_BUCKETS - 1)]++;
+
+		cond_resched();
+	}
+	t->stop_ns = loadgen_now();
+
+	return 0;
+}
+
+static void loadgen_stop(void)
+{
+	unsigned int i;
+
+	if (!loadgen_running)
+		return;
+
+	for (i = 0; i < loadgen_nthreads; i++) {
+		if (loadgen_threads[i].task)
+			kthread_stop(loadgen_threads[i].task);
+	}
+	loadgen_running = false;
+}
+
+static void loadgen_free(void)
+{
+	unsigned int i;
+
+	if (!loadgen_threads)
+		return;
+
+	for (i = 0; i < loadgen_nthreads; i++)
+		kfree(loadgen_threads[i].buffer);
+	kfree(loadgen_threads);
+	loadgen_threads = NULL;
+	loadgen_nthreads = 0;
+}
+
+// The parameters may be changed through sysfs after the loading, so they are
+// checked at the loading and at every start.
+static int loadgen_check_params(void)
+{
+	int i;
+
+	if (size_max < size_min || ntypes < 1)
+		return -EINVAL;
+	for (i = 0; i < ntypes; i++) {
+		if (types[i] > 255) {
+			pr_err("The service type %u is beyond 255\n", types[i]);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static int loadgen_start(void)
+{
+	struct loadgen_thread *t;
+	unsigned int i, n, cpu;
+	int err;
+
+	if (loadgen_running)
+		return 0;
+	err = loadgen_check_params();
+	if (err)
+		return err;
+
+	loadgen_cfg.interval = rate ? NSEC_PER_SEC / rate : 0;
+	loadgen_cfg.size_min = size_min;
+	loadgen_cfg.size_max = size_max;
+	for (i = 0; i < ntypes; i++)
+		loadgen_cfg.types[i] = (__u8)types[i];
+	loadgen_cfg.ntypes = ntypes;
+	loadgen_cfg.broadcast = broadcast;
+	loadgen_cfg.dest = dest;
+
+	// The stats of the last run are kept until the next start.
+	loadgen_free();
+
+	n = threads ? threads : num_online_cpus();
+	loadgen_threads = kcalloc(n, sizeof(*loadgen_threads), GFP_KERNEL);
+	if (!loadgen_threads)
+		return -ENOMEM;
+	loadgen_nthreads = n;
+
+	for (i = 0; i < n; i++) {
+		t = &loadgen_threads[i];
+		t->buffer = kmalloc(max(loadgen_cfg.size_max, 1U), GFP_KERNEL);
+		if (!t->buffer)
+			goto error;
+		memset(t->buffer, 0x5A, max(loadgen_cfg.size_max, 1U));
+	}
+
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < n; i++) {
+		t = &loadgen_threads[i];
+		t->task = kthread_create(loadgen_fn, t, "nl_loadgen/%u", i);
+		if (IS_ERR(t->task)) {
+			t->task = NULL;
+			goto error;
+		}
+		kthread_bind(t->task, cpu);
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+
+	for (i = 0; i < n; i++)
+		wake_up_process(loadgen_threads[i].task);
+	loadgen_running = true;
+	return 0;
+
+error:
+	// The threads which have been created have not run yet.
+	for (i = 0; i < n; i++) {
+		if (loadgen_threads[i].task)
+			kthread_stop(loadgen_threads[i].task);
+	}
+	loadgen_free();
+	return -ENOMEM;
+}
+
+/// -----------------------------------------------------------------------
+/// debugfs
+
+static int loadgen_stats_show(struct seq_file *m, void *v)
+{
+	struct loadgen_stats total;
+	unsigned int i, b;
+	u64 ns, now, rate, total_rate = 0;
+
+	memset(&total, 0, sizeof(total));
+
+	mutex_lock(&loadgen_lock);
+	now = loadgen_now();
+	seq_printf(m, "running: %d\n", loadgen_running);
+	for (i = 0; i < loadgen_nthreads; i++) {
+		struct loadgen_thread *t = &loadgen_threads[i];
+
+		ns = (loadgen_running ? now : t->stop_ns) - t->start_ns;
+		rate = ns ? div64_u64(t->stats.calls * NSEC_PER_SEC, ns) : 0;
+		seq_printf(m, "thread %u: calls %llu failures %llu bytes %llu rate %llu/s\n",
+				i, t->stats.calls, t->stats.failures, t->stats.bytes, rate);
+		total_rate += rate;
+
+		total.calls += t->stats.calls;
+		total.failures += t->stats.failures;
+		total.bytes += t->stats.bytes;
+		for (b = 0; b < LOADGEN_LAT_BUCKETS; b++)
+			total.latency[b] += t->stats.latency[b];
+	}
+	mutex_unlock(&loadgen_lock);
+
+	seq_printf(m, "total: calls %llu failures %llu bytes %llu rate %llu/s\n",
+			total.calls, total.failures, total.bytes, total_rate);
+	seq_puts(m, "latency (ns):\n");
+	for (b = 0; b < LOADGEN_LAT_BUCKETS; b++) {
+		if (total.latency[b])
+			seq_printf(m, "  [%llu, %llu): %llu\n", 1ULL << b, 1ULL << (b + 1), total.latency[b]);
+	}
+
+	return 0;
+}
+
+static int loadgen_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, loadgen_stats_show, NULL);
+}
+
+static const struct file_operations loadgen_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = loadgen_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static ssize_t loadgen_run_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+	char buf[4];
+	int len;
+
+	len = scnprintf(buf, sizeof(buf), "%d\n", loadgen_running);
+	return simple_read_from_buffer(ubuf, count, ppos, buf, len);
+}
+
+static ssize_t loadgen_run_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	char buf[8];
+	bool run;
+	int err;
+
+	// kstrtobool_from_user() for 4.6 kernel and above
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	err = strtobool(buf, &run);
+	if (err)
+		return err;
+
+	mutex_lock(&loadgen_lock);
+	if (run) {
+		err = loadgen_start();
+	} else {
+		loadgen_stop();
+	}
+	mutex_unlock(&loadgen_lock);
+
+	return err ? err : count;
+}
+
+static const struct file_operations loadgen_run_fops = {
+	.owner = THIS_MODULE,
+	.read = loadgen_run_read,
+	.write = loadgen_run_write,
+	.llseek = default_llseek,
+};
+
+
+static int __init loadgen_init(void)
+{
+	int err;
+
+	pr_info("Loading Netlink Load Generator\n");
+	err = loadgen_check_params();
+	if (err)
+		return err;
+
+	loadgen_dir = debugfs_create_dir("test_netlink_loadgen", NULL);
+	if (IS_ERR_OR_NULL(loadgen_dir))
+		return -ENOMEM;
+
+	debugfs_create_file("run", 0644, loadgen_dir, NULL, &loadgen_run_fops);
+	debugfs_create_file("stats", 0444, loadgen_dir, NULL, &loadgen_stats_fops);
+	return 0;
+}
+
+static void __exit loadgen_exit(void)
+{
+	pr_info("Unloading Netlink Load Generator\n");
+
+	debugfs_remove_recursive(loadgen_dir);
+	mutex_lock(&loadgen_lock);
+	loadgen_stop();
+	loadgen_free();
+	mutex_unlock(&loadgen_lock);
+}
+
+module_init(loadgen_init);
+module_exit(loadgen_exit);
+
+MODULE_DESCRIPTION("TEST Netlink Load Generator");
+MODULE_LICENSE("GPL");
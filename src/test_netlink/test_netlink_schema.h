@@ -0,0 +1,102 @@
+#ifndef TEST_NETLINK_SCHEMA
+#define TEST_NETLINK_SCHEMA
+
+/*
+ * The fixed-layout records of the service messages.
+ *
+ * A service message of a schema type carries an array of packed records, in
+ * the native byte order, after the type byte. Both the kernel and _netlink.c
+ * include this header: the kernel gets a struct and an encoder for every
+ * schema, and an upcall which sends many records in one message; _netlink.c
+ * gets the table from which decode_records() turns a batch of records into
+ * tuples or columns.
+ *
+ * To add a schema, define its service type and fields, then add it to
+ * TEST_NETLINK_SCHEMAS. A field is FIELD(name, type, code), where code is the
+ * type code of the Python array module.
+ */
+
+#include <linux/types.h>
+
+#define NL_TYPE_REPLAY		14
+#define NL_TYPE_TELEMETRY	16
+#define NL_TYPE_COUNTER		17
+
+// A request to replay the history of the service type `type` from the
+// sequence number `seq`, see test_netlink.c.
+#define NL_REPLAY_FIELDS(FIELD) \
+	FIELD(type, __u8, "B") \
+	FIELD(seq, __u32, "I")
+
+#define NL_TELEMETRY_FIELDS(FIELD) \
+	FIELD(timestamp, __u64, "Q") \
+	FIELD(cpu, __u32, "I") \
+	FIELD(id, __u32, "I") \
+	FIELD(value, __s64, "q")
+
+#define NL_COUNTER_FIELDS(FIELD) \
+	FIELD(id, __u32, "I") \
+	FIELD(delta, __u32, "I") \
+	FIELD(total, __u64, "Q")
+
+// SCHEMA(name, service type, fields)
+#define TEST_NETLINK_SCHEMAS(SCHEMA) \
+	SCHEMA(replay, NL_TYPE_REPLAY, NL_REPLAY_FIELDS) \
+	SCHEMA(telemetry, NL_TYPE_TELEMETRY, NL_TELEMETRY_FIELDS) \
+	SCHEMA(counter, NL_TYPE_COUNTER, NL_COUNTER_FIELDS)
+
+#define NL_SCHEMA_MAX_FIELDS	16
+
+// An upcall of a type whose time stamps are enabled, see set_service_timestamp,
+// has NL_F_TIMESTAMP in nlmsg_flags, and a struct nl_stamp between the type
+// byte and the service data. `ns` is the CLOCK_MONOTONIC time of the upcall,
+// and `cpu` the CPU which made it.
+#define NL_F_TIMESTAMP	0x1000
+
+struct nl_stamp {
+	__u64 ns;
+	__u32 cpu;
+} __attribute__((packed));
+
+/////
+
+#define NL_SCHEMA_MEMBER(name, type, code)	type name;
+#define NL_SCHEMA_ARG(name, type, code)		, type name
+#define NL_SCHEMA_SET(name, type, code)		rec->name = name;
+
+// struct nl_rec_<name>, and nl_put_<name>(rec, fields...) to fill one.
+#define NL_SCHEMA_DEFINE(schema, stype, FIELDS) \
+	struct nl_rec_##schema { \
+		FIELDS(NL_SCHEMA_MEMBER) \
+	} __attribute__((packed)); \
+	\
+	static inline void nl_put_##schema(struct nl_rec_##schema *rec FIELDS(NL_SCHEMA_ARG)) \
+	{ \
+		FIELDS(NL_SCHEMA_SET) \
+	}
+
+TEST_NETLINK_SCHEMAS(NL_SCHEMA_DEFINE)
+
+
+#ifdef __KERNEL__
+#include "test_netlink.h"
+
+// upcall_<name>(recs, n, pg, group): send n records in one service message,
+// to the pid `pg`, or to the group `pg` if `group`, in &init_net.
+// upcall_<name>_net(net, recs, n, pg, group) sends them in the namespace `net`.
+#define NL_SCHEMA_UPCALL(schema, stype, FIELDS) \
+	static inline int upcall_##schema##_net(struct net *net, struct nl_rec_##schema *recs, \
+			size_t n, __u32 pg, bool group) \
+	{ \
+		return upcall_service_to_pid_or_group_net(net, recs, n * sizeof(*recs), stype, pg, group); \
+	} \
+	\
+	static inline int upcall_##schema(struct nl_rec_##schema *recs, size_t n, __u32 pg, bool group) \
+	{ \
+		return upcall_##schema##_net(&init_net, recs, n, pg, group); \
+	}
+
+TEST_NETLINK_SCHEMAS(NL_SCHEMA_UPCALL)
+#endif
+
+#endif  /* TEST_NETLINK_SCHEMA */
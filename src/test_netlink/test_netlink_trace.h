@@ -0,0 +1,136 @@
+/*
+ * Tracepoints of test_netlink.
+ *
+ * Every event carries the service type, the size of the service data and the
+ * destination (a pid, or a group if `group`), so that the stages of an upcall
+ * or a dispatch can be matched up with perf or ftrace, e.g.
+ *     perf record -e 'test_netlink:*' -a
+ *     echo 1 > /sys/kernel/debug/tracing/events/test_netlink/enable
+ * They cost nothing but a static branch while disabled.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM test_netlink
+
+#if !defined(_TEST_NETLINK_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TEST_NETLINK_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// The upcall: nl_skb_alloc, then nl_send_start and nl_send_end around
+// netlink_broadcast or nlmsg_unicast.
+DECLARE_EVENT_CLASS(nl_upcall,
+
+	TP_PROTO(__u8 type, size_t size, __u32 dest, bool group),
+
+	TP_ARGS(type, size, dest, group),
+
+	TP_STRUCT__entry(
+		__field(__u8, type)
+		__field(size_t, size)
+		__field(__u32, dest)
+		__field(bool, group)
+	),
+
+	TP_fast_assign(
+		__entry->type = type;
+		__entry->size = size;
+		__entry->dest = dest;
+		__entry->group = group;
+	),
+
+	TP_printk("type=%u size=%zu %s=%u", __entry->type, __entry->size,
+		__entry->group ? "group" : "pid", __entry->dest)
+);
+
+DEFINE_EVENT(nl_upcall, nl_skb_alloc,
+	TP_PROTO(__u8 type, size_t size, __u32 dest, bool group),
+	TP_ARGS(type, size, dest, group)
+);
+
+DEFINE_EVENT(nl_upcall, nl_send_start,
+	TP_PROTO(__u8 type, size_t size, __u32 dest, bool group),
+	TP_ARGS(type, size, dest, group)
+);
+
+TRACE_EVENT(nl_send_end,
+
+	TP_PROTO(__u8 type, size_t size, __u32 dest, bool group, int ret),
+
+	TP_ARGS(type, size, dest, group, ret),
+
+	TP_STRUCT__entry(
+		__field(__u8, type)
+		__field(size_t, size)
+		__field(__u32, dest)
+		__field(bool, group)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->type = type;
+		__entry->size = size;
+		__entry->dest = dest;
+		__entry->group = group;
+		__entry->ret = ret;
+	),
+
+	TP_printk("type=%u size=%zu %s=%u ret=%d", __entry->type, __entry->size,
+		__entry->group ? "group" : "pid", __entry->dest, __entry->ret)
+);
+
+// The dispatch of a message from the userspace to its service handler, the
+// destination is the pid of the sender.
+TRACE_EVENT(nl_handler_entry,
+
+	TP_PROTO(__u8 type, size_t size, __u32 pid),
+
+	TP_ARGS(type, size, pid),
+
+	TP_STRUCT__entry(
+		__field(__u8, type)
+		__field(size_t, size)
+		__field(__u32, pid)
+	),
+
+	TP_fast_assign(
+		__entry->type = type;
+		__entry->size = size;
+		__entry->pid = pid;
+	),
+
+	TP_printk("type=%u size=%zu pid=%u", __entry->type, __entry->size, __entry->pid)
+);
+
+TRACE_EVENT(nl_handler_exit,
+
+	TP_PROTO(__u8 type, size_t size, __u32 pid, bool handled),
+
+	TP_ARGS(type, size, pid, handled),
+
+	TP_STRUCT__entry(
+		__field(__u8, type)
+		__field(size_t, size)
+		__field(__u32, pid)
+		__field(bool, handled)
+	),
+
+	TP_fast_assign(
+		__entry->type = type;
+		__entry->size = size;
+		__entry->pid = pid;
+		__entry->handled = handled;
+	),
+
+	TP_printk("type=%u size=%zu pid=%u handled=%d", __entry->type, __entry->size,
+		__entry->pid, __entry->handled)
+);
+
+#endif /* _TEST_NETLINK_TRACE_H */
+
+// This part must be outside the protection.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE test_netlink_trace
+#include <trace/define_trace.h>